@@ -0,0 +1,125 @@
+/**
+ * @file FsBench.ino
+ * @brief Runs the same benchmark scenarios on LittleFS and on the SD card.
+ * @details The scenarios run once per backend and cache configuration: uncached, 2 and
+ *          8 cache pages of 512 bytes, and 8 pages of the size calibrate() measures for
+ *          the backend (flash blocks are usually 4 KiB). Each configuration starts from
+ *          a fresh file and prints its page size. Each scenario resets the counters,
+ *          runs a fixed workload, flushes and prints one printStats() line named after
+ *          the backend and the configuration, for example "lfs_c8_update" and
+ *          "sd_c8_update". Record a run with `tools/sdbench.py record run.log baseline.json`
+ *          and compare later runs against it. Needs SDSTORAGE_FS (ESP32, ESP8266, RP2040)
+ *          and an SD card on chip select pin 4.
+ */
+
+#include <LittleFS.h>
+#include <SD.h>
+#include <SDStorage.h>
+
+#if !SDSTORAGE_FS
+#error "the LittleFS backend needs SDSTORAGE_FS (ESP32, ESP8266, RP2040)"
+#endif
+
+#define CS_PIN 4
+#define STORAGE_SIZE 8192
+#define FILENAME "/bench.bin"
+
+/**
+ * @brief One cache configuration of the sweep.
+ */
+struct BenchConfig {
+  const char *name;    ///< Part of the scenario names.
+  uint8_t cachePages;  ///< SDStorageConfig::cachePages.
+  bool calibrate;      ///< Let calibrate() choose the page size instead of 512 bytes.
+};
+
+static const BenchConfig CONFIGS[] = {
+    {"c0", 0, false},
+    {"c2", 2, false},
+    {"c8", 8, false},
+    {"c8cal", 8, true},
+};
+
+struct Settings {
+  uint16_t mode;
+  uint16_t flags;
+  int32_t limits[3];
+};
+
+static void report(SDStorage &storage, const char *backend, const char *scenario) {
+  char name[24];
+  snprintf(name, sizeof(name), "%s_%s", backend, scenario);
+  storage.flush();
+  storage.printStats(Serial, name);
+}
+
+/**
+ * @brief Runs all scenarios on a mounted storage.
+ */
+static void runScenarios(SDStorage &storage, const char *backend) {
+  storage.resetStats();
+  for (uint16_t i = 0; i < 200; i++) {
+    Settings settings = {(uint16_t)(i & 3), i, {i, -i, 2 * i}};
+    storage.update((i % 32) * sizeof(Settings), settings);
+  }
+  report(storage, backend, "update");
+
+  storage.resetStats();
+  for (uint16_t i = 0; i < 500; i++) storage.fetchAdd<uint32_t>(1024 + (i % 8) * sizeof(uint32_t), 1);
+  report(storage, backend, "counter");
+
+  storage.resetStats();
+  uint8_t record[32];
+  for (uint16_t i = 0; i < 200; i++) {
+    memset(record, (uint8_t)i, sizeof(record));
+    storage.write(2048 + (i % 192) * sizeof(record), record);
+  }
+  report(storage, backend, "log");
+}
+
+/**
+ * @brief Runs the scenarios for every configuration on one backend.
+ * @param backend Prefix of the scenario names.
+ * @param fs Mounted filesystem, nullptr for the SD library.
+ */
+static void runConfigs(const char *backend, fs::FS *fs) {
+  for (const BenchConfig &bench : CONFIGS) {
+    SDStorageConfig config;
+    config.cachePages = bench.cachePages;
+    config.calibrate = bench.calibrate;
+    // A fresh file, so no tuning persisted by an earlier calibration is picked up.
+    if (fs) {
+      fs->remove(FILENAME);
+    } else {
+      SD.remove(FILENAME);
+    }
+    SDStorage storage;
+    bool ok = fs ? storage.begin(STORAGE_SIZE, FILENAME, *fs, config) : storage.begin(STORAGE_SIZE, FILENAME, CS_PIN, config);
+    char name[16];
+    snprintf(name, sizeof(name), "%s_%s", backend, bench.name);
+    if (!ok) {
+      Serial.printf("%s: begin failed\n", name);
+      continue;
+    }
+    Serial.printf("%s: page size %u\n", name, (unsigned)storage.getTuning().pageSize);
+    runScenarios(storage, name);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+
+#if defined(ESP32)
+  bool mounted = LittleFS.begin(true);
+#else
+  bool mounted = LittleFS.begin();
+#endif
+  if (mounted) {
+    runConfigs("lfs", &LittleFS);
+  } else {
+    Serial.println(F("LittleFS mount failed"));
+  }
+  runConfigs("sd", nullptr);
+}
+
+void loop() {}
@@ -0,0 +1,214 @@
+/**
+ * @file SelfTest.ino
+ * @brief On-device checks of SDStorage behaviour that only shows up across remounts.
+ * @details Needs an SD card on chip select pin 4; with SDSTORAGE_FS the LittleFS checks
+ *          also need a LittleFS partition. Every check works on its own file,
+ *          prints PASS or FAIL with its name and removes the file again.
+ */
+
+#include <SD.h>
+#if defined(ESP32) || defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
+#include <LittleFS.h>
+#endif
+#include <SDBlob.h>
+#include <SDPartition.h>
+#include <SDStorage.h>
+
+#define CS_PIN 4
+#define STORAGE_SIZE 4096
+
+static uint8_t failures = 0;
+
+static void report(const __FlashStringHelper *name, bool ok) {
+  Serial.print(ok ? F("PASS ") : F("FAIL "));
+  Serial.println(name);
+  if (!ok) failures++;
+}
+
+/**
+ * @brief Writes a file like the original format() did: the size header and the data,
+ *        no metadata, and the whole file 512 bytes shorter than the storage size.
+ */
+static bool writeBaselineFile(const char *filename) {
+  SD.remove(filename);
+  File file = SD.open(filename, FILE_WRITE);
+  if (!file) return false;
+  uint32_t size = STORAGE_SIZE;
+  bool ok = file.write((const uint8_t *)&size, sizeof(size)) == sizeof(size);
+  uint8_t zero[64] = {0};
+  for (uint32_t i = sizeof(size); ok && i < STORAGE_SIZE - 512;) {
+    uint16_t n = (STORAGE_SIZE - 512 - i < sizeof(zero)) ? STORAGE_SIZE - 512 - i : sizeof(zero);
+    ok = file.write(zero, n) == n;
+    i += n;
+  }
+  file.close();
+  return ok;
+}
+
+/**
+ * @brief The end of the data area of a file in the original layout must be readable
+ *        and writable without taking the card offline.
+ */
+static bool tailOfBaselineFile() {
+  const char *filename = "/tail.bin";
+  if (!writeBaselineFile(filename)) return false;
+  bool ok;
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, CS_PIN)) return false;
+    ok = storage.readu8(STORAGE_SIZE - 396) == 0 && storage.isOnline();
+    ok = storage.writeu8(STORAGE_SIZE - 100, 0x5A) && ok;
+    storage.flush();
+  }
+  {
+    SDStorage storage;
+    ok = storage.begin(STORAGE_SIZE, filename, CS_PIN) && storage.readu8(STORAGE_SIZE - 100) == 0x5A && ok;
+  }
+  SD.remove(filename);
+  return ok;
+}
+
+/**
+ * @brief A blob committed on a fresh file, or on one without a blob table, must still be
+ *        there after a remount.
+ */
+static bool blobSurvivesRemount(bool baseline) {
+  const char *filename = "/blob.bin";
+  const uint8_t data[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  SD.remove(filename);
+  if (baseline && !writeBaselineFile(filename)) return false;
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, CS_PIN)) return false;
+    SDBlob blob(storage);
+    if (!blob.create("cert", sizeof(data)) || !blob.write(data, sizeof(data)) || !blob.commit()) return false;
+    storage.flush();
+  }
+  bool ok;
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, CS_PIN)) return false;
+    SDBlob blob(storage);
+    uint8_t read[sizeof(data)] = {0};
+    ok = blob.open("cert") && blob.size() == sizeof(data) && blob.read(read, sizeof(read)) == sizeof(read) &&
+         memcmp(read, data, sizeof(data)) == 0;
+    blob.close();
+    ok = blob.remove("cert") && ok;
+  }
+  SD.remove(filename);
+  return ok;
+}
+
+/**
+ * @brief Wear tracking on a file in the original layout must keep the card online and persist.
+ */
+static bool wearOnBaselineFile() {
+  const char *filename = "/wear.bin";
+  if (!writeBaselineFile(filename)) return false;
+  SDStorageConfig config;
+  config.trackWear = true;
+  bool ok;
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, CS_PIN, config)) return false;
+    for (uint8_t i = 0; i < 5; i++) storage.writeu8(10, i);
+    storage.flush();
+    ok = storage.isOnline();
+  }
+  {
+    SDStorage storage;
+    ok = storage.begin(STORAGE_SIZE, filename, CS_PIN, config) && storage.getSectorWrites(0) >= 5 &&
+         storage.readu8(10) == 4 && ok;
+  }
+  SD.remove(filename);
+  return ok;
+}
+
+/**
+ * @brief A partition at its cache quota whose pages are all pinned must evict from the global LRU.
+ */
+static bool pinnedQuotaPartition() {
+  const char *filename = "/pin.bin";
+  static const uint16_t pins[1] = {1600};
+  SD.remove(filename);
+  SDStorageConfig config;
+  config.cachePages = 4;
+  config.pins = pins;
+  config.pinCount = 1;
+  bool ok;
+  {
+    SDStorage storage;
+    if (!storage.begin(2 * STORAGE_SIZE, filename, CS_PIN, config)) return false;
+    SDStoragePartition partitions[2] = {};
+    memcpy(partitions[0].name, "cfg", 3);
+    partitions[0].region.length = 1024;
+    memcpy(partitions[1].name, "log", 3);
+    partitions[1].region.length = STORAGE_SIZE;
+    partitions[1].region.policy = SDSTORAGE_WRITE_BACK;
+    partitions[1].cachePages = 1;
+    if (!storage.setPartitions(partitions, 2)) return false;
+    SDPartition log(storage, "log");
+    ok = log.begin();
+    for (uint16_t i = 0; ok && i < STORAGE_SIZE; i += 300) ok = log.writeu8(i, 7);
+    log.flush();
+    for (uint16_t i = 0; ok && i < STORAGE_SIZE; i += 300) ok = log.readu8(i) == 7;
+  }
+  SD.remove(filename);
+  return ok;
+}
+
+#if SDSTORAGE_FS
+/**
+ * @brief Data and blobs on LittleFS must survive a remount and never touch the SD card.
+ */
+static bool littleFsRemount() {
+#if defined(ESP32)
+  if (!LittleFS.begin(true)) return false;
+#else
+  if (!LittleFS.begin()) return false;
+#endif
+  const char *filename = "/lfstest.bin";
+  const uint8_t data[4] = {4, 3, 2, 1};
+  LittleFS.remove(filename);
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, LittleFS)) return false;
+    storage.write<uint32_t>(100, 0xDEADBEEF);
+    SDBlob blob(storage);
+    if (!blob.create("cert", sizeof(data)) || !blob.write(data, sizeof(data)) || !blob.commit()) return false;
+    storage.flush();
+  }
+  bool ok;
+  {
+    SDStorage storage;
+    if (!storage.begin(STORAGE_SIZE, filename, LittleFS)) return false;
+    SDBlob blob(storage);
+    uint8_t read[sizeof(data)] = {0};
+    ok = storage.read<uint32_t>(100) == 0xDEADBEEF && blob.open("cert") && blob.read(read, sizeof(read)) == sizeof(read) &&
+         memcmp(read, data, sizeof(data)) == 0;
+    blob.close();
+    ok = blob.remove("cert") && ok;
+  }
+  ok = !SD.exists(filename) && ok;
+  LittleFS.remove(filename);
+  return ok;
+}
+#endif
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial) {
+  }
+  report(F("blob survives remount, fresh file"), blobSurvivesRemount(false));
+  report(F("blob survives remount, baseline file"), blobSurvivesRemount(true));
+  report(F("wear on baseline file"), wearOnBaselineFile());
+  report(F("tail of baseline file"), tailOfBaselineFile());
+  report(F("pinned quota partition"), pinnedQuotaPartition());
+#if SDSTORAGE_FS
+  report(F("LittleFS remount"), littleFsRemount());
+#endif
+  Serial.print(failures);
+  Serial.println(F(" failed"));
+}
+
+void loop() {}
@@ -0,0 +1,111 @@
+/**
+ * @file SeqlockStress.ino
+ * @brief Stress test and read-throughput benchmark of readCached() across the two ESP32 cores.
+ * @details loop() owns the storage on core 1. It rewrites a 16-byte record and writes
+ *          to the rest of the file so the record's page is evicted and loaded again.
+ *          It also rewrites a second record that spans two pages, in two halves
+ *          inside a write batch. A task on core 0 reads the first record with
+ *          readCached() and the second with readSnapshotCached() as fast as it can
+ *          and checks that every copy is one whole record. Every 5 seconds the
+ *          sketch prints reads per second, misses (record not resident) and torn
+ *          copies of both records, which must stay 0. Needs an SD card on chip
+ *          select pin 4.
+ */
+
+#include <SDStorage.h>
+
+#if !SDSTORAGE_SEQLOCK
+#error "readCached() from another core needs SDSTORAGE_SEQLOCK (default on ESP32)"
+#endif
+
+#define CS_PIN 4
+#define STORAGE_SIZE 8192
+#define REPORT_MS 5000
+#define SPLIT_ADDR 504  ///< Second record, across the first page boundary (file offset 512).
+
+struct Record {
+  uint8_t bytes[16];  ///< bytes[i] == bytes[0] + i in every complete record.
+};
+
+static SDStorage storage;
+static volatile uint32_t reads = 0;
+static volatile uint32_t misses = 0;
+static volatile uint32_t torn = 0;
+static volatile uint32_t snapshotTorn = 0;
+static uint8_t sequence = 0;
+
+static void nextRecord() {
+  Record record;
+  for (uint8_t i = 0; i < sizeof(record.bytes); i++) record.bytes[i] = sequence + i;
+  sequence++;
+  storage.write(0, record);
+  // Half a record at a time: only the batch keeps a snapshot reader from seeing the mix.
+  uint64_t half[2];
+  memcpy(half, record.bytes, sizeof(half));
+  storage.beginBatch();
+  storage.write(SPLIT_ADDR, half[0]);
+  storage.write(SPLIT_ADDR + 8, half[1]);
+  storage.commitBatch();
+}
+
+static bool whole(const Record &record) {
+  for (uint8_t i = 1; i < sizeof(record.bytes); i++) {
+    if (record.bytes[i] != (uint8_t)(record.bytes[0] + i)) return false;
+  }
+  return true;
+}
+
+static void reader(void *) {
+  Record copy;
+  for (uint32_t n = 0;; n++) {
+    if (storage.readCached(0, copy.bytes, sizeof(copy.bytes))) {
+      reads++;
+      if (!whole(copy)) torn++;
+    } else {
+      misses++;
+    }
+    if (storage.readSnapshotCached(SPLIT_ADDR, copy.bytes, sizeof(copy.bytes))) {
+      reads++;
+      if (!whole(copy)) snapshotTorn++;
+    } else {
+      misses++;
+    }
+    // Let the idle task feed the watchdog.
+    if ((n & 0x3FF) == 0) vTaskDelay(1);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  SDStorageConfig config;
+  config.cachePages = 2;
+  config.snapshotBytes = 64;
+  if (!storage.begin(STORAGE_SIZE, "/seqlock.bin", CS_PIN, config)) {
+    Serial.println(F("begin failed"));
+    for (;;) delay(1000);
+  }
+  // The reader expects complete records from the start.
+  nextRecord();
+  xTaskCreatePinnedToCore(reader, "reader", 2048, nullptr, 1, nullptr, 0);
+}
+
+void loop() {
+  static uint32_t last = millis();
+  static uint32_t lastReads = 0;
+  nextRecord();
+  // Now and then write two other pages, which evicts the record's page from the cache.
+  if ((sequence & 0x3F) == 0) {
+    storage.writeu8(2048 + sequence, sequence);
+    storage.writeu8(4096 + sequence, sequence);
+  }
+  storage.poll();
+  uint32_t now = millis();
+  if (now - last >= REPORT_MS) {
+    uint32_t count = reads;
+    Serial.printf("reads/s=%lu misses=%lu torn=%lu snapshot torn=%lu\n",
+                  (unsigned long)((count - lastReads) * 1000ULL / (now - last)), (unsigned long)misses, (unsigned long)torn,
+                  (unsigned long)snapshotTorn);
+    lastReads = count;
+    last = now;
+  }
+}
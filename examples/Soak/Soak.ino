@@ -0,0 +1,79 @@
+/**
+ * @file Soak.ino
+ * @brief Soak driver: a randomized operation mix for long runs, charted by tools/sdsoak.py.
+ * @details Half of the operations update a settings record, 30% bump a counter, 19% append
+ *          to a log ring and 1% flush and remount as a reboot would. Every REPORT_OPS
+ *          operations the running totals are printed with printStats(Serial, "soak").
+ *          Capture the serial output for hours and run `tools/sdsoak.py run.log`.
+ *          Needs an SD card on chip select pin 4 and SDSTORAGE_LATENCY (off on AVR).
+ */
+
+#include <SDStorage.h>
+
+#if !SDSTORAGE_LATENCY
+#error "the soak report needs the latency histogram, build with SDSTORAGE_LATENCY=1"
+#endif
+
+#define CS_PIN 4
+#define STORAGE_SIZE 8192
+#define SETTINGS 0       // 64 settings records
+#define COUNTERS 1024    // 16 counters
+#define LOG 2048         // log ring up to the end of the storage
+#define REPORT_OPS 10000
+
+struct Settings {
+  uint16_t mode;
+  uint16_t flags;
+  int32_t limits[3];
+};
+
+struct LogRecord {
+  uint32_t time;
+  uint32_t sequence;
+  uint8_t payload[24];
+};
+
+static SDStorage storage;
+static SDStorageConfig config;
+static uint32_t sequence = 0;
+
+static bool mount() {
+  return storage.begin(STORAGE_SIZE, "/soak.bin", CS_PIN, config);
+}
+
+void setup() {
+  Serial.begin(115200);
+  randomSeed(analogRead(0));
+  config.cachePages = 4;
+  if (!mount()) {
+    Serial.println(F("begin failed"));
+    for (;;) delay(1000);
+  }
+}
+
+void loop() {
+  static uint32_t ops = 0;
+  uint8_t op = random(100);
+  if (op < 50) {
+    Settings settings;
+    settings.mode = random(4);
+    settings.flags = random(0x10000);
+    for (uint8_t i = 0; i < 3; i++) settings.limits[i] = random(-1000, 1000);
+    storage.update(SETTINGS + random(64) * sizeof(Settings), settings);
+  } else if (op < 80) {
+    storage.fetchAdd<uint32_t>(COUNTERS + random(16) * sizeof(uint32_t), 1);
+  } else if (op < 99) {
+    LogRecord record;
+    record.time = millis();
+    record.sequence = sequence;
+    memset(record.payload, (uint8_t)sequence, sizeof(record.payload));
+    uint16_t slots = (STORAGE_SIZE - LOG) / sizeof(LogRecord);
+    storage.write(LOG + (sequence++ % slots) * sizeof(LogRecord), record);
+  } else {
+    // Reboot: begin() writes the cache back and reopens the file; the counters keep running.
+    storage.flush();
+    mount();
+  }
+  storage.poll();
+  if (++ops % REPORT_OPS == 0) storage.printStats(Serial, "soak");
+}
@@ -0,0 +1,244 @@
+/**
+ * @file PersistentArray.h
+ * @brief Header file for the PersistentArray class template, a table of fixed-size records in SDStorage.
+ * @author Ferenc Mayer
+ * @date 2025-06-02
+ */
+
+#pragma once
+/**
+ * @brief Prevents multiple inclusions of the header file.
+ */
+
+#include "SDStorage.h"
+/**
+ * @brief Includes SDStorage, which holds the records.
+ */
+
+#ifndef PERSISTENTARRAY_WINDOW
+#if defined(__AVR__)
+#define PERSISTENTARRAY_WINDOW 128  ///< Iterator and bulk-write buffer in bytes (AVR).
+#else
+#define PERSISTENTARRAY_WINDOW 512  ///< Iterator and bulk-write buffer in bytes, one sector.
+#endif
+#endif
+
+/**
+ * @brief Fixed-size table of records of type T stored in an SDStorage.
+ * @details Records are placed so that none straddles a 512-byte sector of the
+ *          backing file: when the next record would cross a sector boundary it
+ *          starts at the next sector instead, and the slack is left unused. Records
+ *          larger than a sector are stored back to back. Iteration reads all records
+ *          of a sector with one call, fill() and assign() write them in one burst.
+ * @tparam T Trivially copyable record type.
+ */
+template <class T>
+class PersistentArray {
+ private:
+  static const uint16_t SECTOR = 512;                               ///< Sector size of the backing file.
+  static const uint16_t FILE_OFFSET = 4;                            ///< Storage address 0 in the backing file.
+  static const uint16_t PER_SECTOR = (sizeof(T) <= SECTOR) ? SECTOR / sizeof(T) : 0; ///< Records per sector, 0 if T is larger.
+  static const uint16_t WINDOW = (sizeof(T) > PERSISTENTARRAY_WINDOW) ? sizeof(T) : PERSISTENTARRAY_WINDOW; ///< Buffer size.
+
+  SDStorage &_storage; ///< Storage holding the records.
+  uint16_t _base;      ///< Address of the first record.
+  uint16_t _count;     ///< Number of records.
+  uint16_t _first;     ///< Records that fit before the first sector boundary.
+
+ public:
+  /**
+   * @brief Forward iterator reading one sector of records per storage call.
+   */
+  class iterator {
+   private:
+    const PersistentArray *_array;  ///< Iterated table.
+    uint16_t _index;                ///< Current record.
+    uint16_t _from = 0;             ///< First record held in _window.
+    uint16_t _held = 0;             ///< Number of records held in _window.
+    uint8_t _window[WINDOW];        ///< Records of the current run.
+    T _value;                       ///< Current record, aligned copy.
+
+   public:
+    /**
+     * @brief Constructs an iterator.
+     * @param array Iterated table.
+     * @param index First record.
+     */
+    iterator(const PersistentArray *array, uint16_t index) : _array(array), _index(index) {}
+
+    /**
+     * @brief Returns the current record, reading the next run of records when needed.
+     * @return Record, or a value-initialized T if the read failed.
+     */
+    const T &operator*() {
+      if (_index < _from || _index >= _from + _held) {
+        _from = _index;
+        _held = _array->_run(_index, WINDOW / sizeof(T));
+        if (!_array->_storage.readArray(_array->address(_index), _window, _held * sizeof(T))) {
+          _held = 0;
+          _value = T();
+          return _value;
+        }
+      }
+      memcpy(&_value, _window + (_index - _from) * sizeof(T), sizeof(T));
+      return _value;
+    }
+
+    /**
+     * @brief Advances to the next record.
+     * @return This iterator.
+     */
+    iterator &operator++() {
+      _index++;
+      return *this;
+    }
+
+    /**
+     * @brief Compares positions.
+     * @param other Iterator to compare with.
+     * @return true if both point to different records.
+     */
+    bool operator!=(const iterator &other) const { return _index != other._index; }
+
+    /**
+     * @brief Compares positions.
+     * @param other Iterator to compare with.
+     * @return true if both point to the same record.
+     */
+    bool operator==(const iterator &other) const { return _index == other._index; }
+  };
+
+  /**
+   * @brief Constructs a table view; nothing is read or written.
+   * @param storage Storage holding the records (must outlive this object).
+   * @param base Address of the first record.
+   * @param count Number of records.
+   */
+  PersistentArray(SDStorage &storage, uint16_t base, uint16_t count) : _storage(storage), _base(base), _count(count) {
+    uint16_t room = SECTOR - (base + FILE_OFFSET) % SECTOR;
+    _first = PER_SECTOR ? room / sizeof(T) : count;
+  }
+
+  /**
+   * @brief Returns the number of records.
+   * @return Record count.
+   */
+  uint16_t size() const { return _count; }
+
+  /**
+   * @brief Returns the storage bytes the table spans, slack included.
+   * @return Bytes from the first address to the end of the last record.
+   */
+  uint32_t bytes() const { return _count ? (uint32_t)address(_count - 1) + sizeof(T) - _base : 0; }
+
+  /**
+   * @brief Returns the storage address of a record.
+   * @param index Record index (not checked).
+   * @return Address.
+   */
+  uint16_t address(uint16_t index) const {
+    if (index < _first) return _base + index * sizeof(T);
+    uint16_t j = index - _first;
+    uint32_t sector = ((uint32_t)_base + FILE_OFFSET + SECTOR - 1) / SECTOR * SECTOR;
+    return sector - FILE_OFFSET + (uint32_t)(j / PER_SECTOR) * SECTOR + (j % PER_SECTOR) * sizeof(T);
+  }
+
+  /**
+   * @brief Reads a record.
+   * @param index Record index.
+   * @param value Receives the record.
+   * @return true if successful, false if the index is out of range or the read failed.
+   */
+  bool get(uint16_t index, T &value) const {
+    if (index >= _count) return false;
+    return _storage.readArray(address(index), (uint8_t *)&value, sizeof(T)) != nullptr;
+  }
+
+  /**
+   * @brief Writes a record, only the bytes that changed.
+   * @param index Record index.
+   * @param value Record to store.
+   * @return true if successful, false if the index is out of range or the write failed.
+   */
+  bool set(uint16_t index, const T &value) {
+    if (index >= _count) return false;
+    return _storage.updateArray(address(index), (const uint8_t *)&value, sizeof(T));
+  }
+
+  /**
+   * @brief Reads a record by value.
+   * @param index Record index.
+   * @return Record, or a value-initialized T if the index is out of range or the read failed.
+   */
+  T operator[](uint16_t index) const {
+    T value = T();
+    if (!get(index, value)) value = T();
+    return value;
+  }
+
+  /**
+   * @brief Writes the same record to every index, one burst per sector.
+   * @param value Record to store.
+   * @return true if successful, false otherwise.
+   */
+  bool fill(const T &value) {
+    uint8_t window[WINDOW];
+    for (uint16_t i = 0; i < WINDOW / sizeof(T); i++) memcpy(window + i * sizeof(T), &value, sizeof(T));
+    for (uint16_t i = 0; i < _count;) {
+      uint16_t n = _run(i, WINDOW / sizeof(T));
+      if (!_storage.writeArray(address(i), window, n * sizeof(T))) return false;
+      i += n;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Writes records from index 0 on, one burst per sector.
+   * @param values Records to store.
+   * @param count Number of records, at most size().
+   * @return true if successful, false if count is too large or a write failed.
+   */
+  bool assign(const T *values, uint16_t count) {
+    if (count > _count) return false;
+    for (uint16_t i = 0; i < count;) {
+      uint16_t n = _run(i, WINDOW / sizeof(T));
+      if (n > count - i) n = count - i;
+      if (!_storage.writeArray(address(i), (const uint8_t *)(values + i), n * sizeof(T))) return false;
+      i += n;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Returns an iterator to the first record.
+   * @return Iterator.
+   */
+  iterator begin() const { return iterator(this, 0); }
+
+  /**
+   * @brief Returns an iterator past the last record.
+   * @return Iterator.
+   */
+  iterator end() const { return iterator(this, _count); }
+
+ private:
+  /**
+   * @brief Returns how many records from index on are contiguous within one sector.
+   * @param index First record.
+   * @param max Upper bound, the buffer capacity in records.
+   * @return Run length, at least 1 for a valid index.
+   */
+  uint16_t _run(uint16_t index, uint16_t max) const {
+    uint16_t n;
+    if (!PER_SECTOR) {
+      n = 1;
+    } else if (index < _first) {
+      n = _first - index;
+    } else {
+      n = PER_SECTOR - (index - _first) % PER_SECTOR;
+    }
+    if (n > max) n = max;
+    if (n > _count - index) n = _count - index;
+    return n;
+  }
+};
@@ -0,0 +1,152 @@
+#include "SDBlob.h"
+
+SDBlob::SDBlob(SDStorage &storage) : _storage(storage) {}
+
+SDBlob::~SDBlob() {
+  close();
+}
+
+void SDBlob::_path(char *path, const char *name, uint8_t generation, bool dirOnly) const {
+  uint8_t n = 0;
+  for (const char *c = _storage._filename; *c && *c != '.' && n < 8; c++) path[n++] = *c;
+  memcpy(path + n, ".blb", 4);
+  n += 4;
+  if (!dirOnly) {
+    path[n++] = '/';
+    for (uint8_t i = 0; i < 8 && name[i]; i++) path[n++] = name[i];
+    path[n++] = '.';
+    path[n++] = '0' + (generation & 1);
+  }
+  path[n] = 0;
+}
+
+bool SDBlob::create(const char *name, uint32_t size) {
+  close();
+  if (_storage._config.readOnly || _storage._offline) {
+    SDSTORAGE_LOG_ERROR(F("cannot write blob '%.8s' to '%s'"), name, _storage._filename);
+    return false;
+  }
+  strncpy(_name, name, sizeof(_name));
+  int8_t slot = _storage._findBlob(_name);
+  _replacing = slot >= 0;
+  _generation = _replacing ? _storage._blobs[slot].generation + 1 : 0;
+  char path[26];
+  _path(path, _name, _generation, true);
+  if (!_storage._fileExists(path) && !_storage._makeDir(path)) {
+    SDSTORAGE_LOG_ERROR(F("cannot create directory '%s'"), path);
+    return false;
+  }
+  _path(path, _name, _generation);
+  if (_storage._fileExists(path)) _storage._removeFile(path);
+  _file = _storage._openFile(path, SDStorage::OPEN_CREATE);
+  if (!_file) {
+    SDSTORAGE_LOG_ERROR(F("cannot create blob file '%s'"), path);
+    return false;
+  }
+  _size = size;
+  _pos = 0;
+  _writing = true;
+  return true;
+}
+
+bool SDBlob::write(const uint8_t *data, uint16_t length) {
+  if (!_writing || _pos + length > _size) return false;
+  if (_file.write(data, length) != length) {
+    SDSTORAGE_LOG_IO(F("Write error: blob '%.8s' offset=%i length=%i"), _name, _pos, length);
+    return false;
+  }
+  _pos += length;
+  return true;
+}
+
+bool SDBlob::commit() {
+  if (!_writing) return false;
+  if (_pos != _size) {
+    SDSTORAGE_LOG_ERROR(F("blob '%.8s' has %i of %i bytes"), _name, _pos, _size);
+    return false;
+  }
+  _file.flush();
+  _file.close();
+  _writing = false;
+  if (!_storage._commitBlob(_name, _size, _generation, true)) {
+    char path[26];
+    _path(path, _name, _generation);
+    _storage._removeFile(path);
+    return false;
+  }
+  if (_replacing) {
+    char path[26];
+    _path(path, _name, _generation - 1);
+    _storage._removeFile(path);
+  }
+  return true;
+}
+
+void SDBlob::abort() {
+  if (!_writing) return;
+  _file.close();
+  _writing = false;
+  char path[26];
+  _path(path, _name, _generation);
+  _storage._removeFile(path);
+}
+
+bool SDBlob::open(const char *name) {
+  close();
+  int8_t slot = _storage._findBlob(name);
+  if (slot < 0 || _storage._offline) return false;
+  strncpy(_name, name, sizeof(_name));
+  _generation = _storage._blobs[slot].generation;
+  _size = _storage._blobs[slot].size;
+  _pos = 0;
+  char path[26];
+  _path(path, _name, _generation);
+  _file = _storage._openFile(path, SDStorage::OPEN_READ);
+  if (!_file) {
+    SDSTORAGE_LOG_ERROR(F("blob file '%s' missing"), path);
+    return false;
+  }
+  return true;
+}
+
+uint16_t SDBlob::read(uint8_t *buffer, uint16_t length) {
+  if (_writing || !_file) return 0;
+  if (length > _size - _pos) length = _size - _pos;
+  int n = _file.read(buffer, length);
+  if (n <= 0) return 0;
+  _pos += n;
+  return n;
+}
+
+bool SDBlob::seek(uint32_t pos) {
+  if (_writing || !_file || pos > _size || !_file.seek(pos)) return false;
+  _pos = pos;
+  return true;
+}
+
+uint32_t SDBlob::size() const {
+  return _size;
+}
+
+uint32_t SDBlob::position() const {
+  return _pos;
+}
+
+void SDBlob::close() {
+  if (_writing) {
+    abort();
+  } else if (_file) {
+    _file.close();
+  }
+}
+
+bool SDBlob::remove(const char *name) {
+  int8_t slot = _storage._findBlob(name);
+  if (slot < 0 || _storage._config.readOnly) return false;
+  uint8_t generation = _storage._blobs[slot].generation;
+  if (!_storage._commitBlob(name, 0, generation + 1, false)) return false;
+  char path[26];
+  _path(path, name, generation);
+  _storage._removeFile(path);
+  return true;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file SDBlob.h
+ * @brief Header file for the SDBlob class, streaming large objects next to an SDStorage file.
+ * @author Ferenc Mayer
+ * @date 2025-06-02
+ */
+
+#pragma once
+/**
+ * @brief Prevents multiple inclusions of the header file.
+ */
+
+#include "SDStorage.h"
+/**
+ * @brief Includes SDStorage, which keeps the blob directory.
+ */
+
+/**
+ * @brief Named blob of up to 4 GiB, streamed through a caller-provided buffer.
+ * @details Blob data lives in its own file in a directory next to the storage file
+ *          ("storage.bin" keeps its blobs in "storage.blb/"), so appends extend the
+ *          FAT cluster chain and never rewrite earlier data, and the 64 KiB address
+ *          space of the storage does not apply. The storage's metadata area holds the
+ *          directory: two check-summed copies of each entry, of which commit() rewrites
+ *          the stale one, so a blob is switched to its new version atomically. Each
+ *          SDBlob holds one file handle while a blob is being written or read.
+ */
+class SDBlob {
+ private:
+  SDStorage &_storage;     ///< Storage holding the blob directory.
+  File _file;              ///< Data file being written or read.
+  char _name[8];           ///< Name of the blob being written or read.
+  uint8_t _generation = 0; ///< Generation of the data file.
+  bool _writing = false;   ///< A create() is pending.
+  bool _replacing = false; ///< The pending create() replaces an existing blob.
+  uint32_t _size = 0;      ///< Expected (writing) or committed (reading) size.
+  uint32_t _pos = 0;       ///< Bytes written or read so far.
+
+  /**
+   * @brief Builds the path of a blob data file.
+   * @param path Output buffer, at least 26 bytes.
+   * @param name Blob name.
+   * @param generation Generation of the data file.
+   * @param dirOnly true to build the directory path only.
+   */
+  void _path(char *path, const char *name, uint8_t generation, bool dirOnly = false) const;
+
+ public:
+  /**
+   * @brief Constructs a blob handle.
+   * @param storage Storage holding the blob directory (must outlive this object).
+   */
+  explicit SDBlob(SDStorage &storage);
+
+  /**
+   * @brief Destructor, aborts a pending write or closes the blob.
+   */
+  ~SDBlob();
+
+  /**
+   * @brief Starts writing a new version of a blob.
+   * @details The previous version stays readable until commit().
+   * @param name Blob name, up to 8 characters valid in a FAT 8.3 name.
+   * @param size Size of the complete blob in bytes.
+   * @return true if successful, false if read-only, offline or the file cannot be created.
+   */
+  bool create(const char *name, uint32_t size);
+
+  /**
+   * @brief Appends a chunk to the blob being written.
+   * @param data Chunk data.
+   * @param length Chunk length.
+   * @return true if successful, false if the chunk exceeds the size given to create() or the write failed.
+   */
+  bool write(const uint8_t *data, uint16_t length);
+
+  /**
+   * @brief Makes the written blob visible, replacing the previous version atomically.
+   * @return true if successful, false if fewer bytes were written than announced or the switch failed.
+   */
+  bool commit();
+
+  /**
+   * @brief Discards the blob being written; the previous version is kept.
+   */
+  void abort();
+
+  /**
+   * @brief Opens the committed version of a blob for reading.
+   * @param name Blob name.
+   * @return true if successful, false if not found.
+   */
+  bool open(const char *name);
+
+  /**
+   * @brief Reads the next chunk of the open blob.
+   * @details Buffers that are a multiple of 512 bytes are read in whole-sector bursts.
+   * @param buffer Destination buffer.
+   * @param length Buffer size.
+   * @return Bytes read, 0 at the end of the blob or on error.
+   */
+  uint16_t read(uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Moves the read position of the open blob.
+   * @param pos New position.
+   * @return true if successful, false if out of range or not open.
+   */
+  bool seek(uint32_t pos);
+
+  /**
+   * @brief Returns the size of the open blob, or the announced size while writing.
+   * @return Size in bytes.
+   */
+  uint32_t size() const;
+
+  /**
+   * @brief Returns the bytes read or written so far.
+   * @return Position in bytes.
+   */
+  uint32_t position() const;
+
+  /**
+   * @brief Closes the open blob; a pending write is aborted.
+   */
+  void close();
+
+  /**
+   * @brief Deletes a committed blob.
+   * @param name Blob name.
+   * @return true if successful, false if not found or the directory update failed.
+   */
+  bool remove(const char *name);
+};
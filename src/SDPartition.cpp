@@ -0,0 +1,90 @@
+#include "SDPartition.h"
+
+SDPartition::SDPartition(SDStorage &storage, const char *name) : _storage(storage) {
+  strncpy(_name, name, sizeof(_name));
+}
+
+bool SDPartition::begin() {
+  _index = _storage._findPartition(_name);
+  if (_index < 0) {
+    SDSTORAGE_LOG_ERROR(F("partition '%.8s' not found"), _name);
+    return false;
+  }
+  return true;
+}
+
+const SDStoragePartition *SDPartition::_entry() const {
+  return (_index < 0 || _index >= _storage._partitionCount) ? nullptr : &_storage._partitions[_index];
+}
+
+uint32_t SDPartition::getSize() {
+  const SDStoragePartition *p = _entry();
+  return p ? p->region.length : 0;
+}
+
+uint8_t SDPartition::readu8(uint16_t addr) {
+  uint8_t val = 0;
+  readArray(addr, &val, 1);
+  return val;
+}
+
+bool SDPartition::writeu8(uint16_t addr, uint8_t val) {
+  return writeArray(addr, &val, 1);
+}
+
+bool SDPartition::updateu8(uint16_t addr, uint8_t val) {
+  return updateArray(addr, &val, 1);
+}
+
+uint8_t *SDPartition::readArray(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  const SDStoragePartition *p = _entry();
+  if (!p || !isValidAddress(addr, length)) {
+    _storage._status = SDSTORAGE_ERR_ADDRESS;
+    return nullptr;
+  }
+  _storage._active = p;
+  uint8_t *ret = _storage.readArray(p->region.start + addr, buffer, length);
+  _storage._active = nullptr;
+  return ret;
+}
+
+bool SDPartition::writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  const SDStoragePartition *p = _entry();
+  if (!p || !isValidAddress(addr, length)) {
+    _storage._status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  _storage._active = p;
+  bool ret = _storage.writeArray(p->region.start + addr, buffer, length);
+  _storage._active = nullptr;
+  return ret;
+}
+
+bool SDPartition::updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  const SDStoragePartition *p = _entry();
+  if (!p || !isValidAddress(addr, length)) {
+    _storage._status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  _storage._active = p;
+  bool ret = _storage.updateArray(p->region.start + addr, buffer, length);
+  _storage._active = nullptr;
+  return ret;
+}
+
+bool SDPartition::format(uint8_t v) {
+  uint8_t buffer[SDSTORAGE_CHUNK_SIZE];
+  memset(buffer, v, sizeof(buffer));
+  uint32_t size = getSize();
+  if (!size) return false;
+  for (uint32_t addr = 0; addr < size; addr += sizeof(buffer)) {
+    uint16_t n = (size - addr < sizeof(buffer)) ? size - addr : sizeof(buffer);
+    if (!writeArray(addr, buffer, n)) return false;
+  }
+  _storage.flush();
+  return true;
+}
+
+void SDPartition::flush() {
+  _storage.flush();
+}
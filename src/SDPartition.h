@@ -0,0 +1,121 @@
+/**
+ * @file SDPartition.h
+ * @brief Header file for the SDPartition class, a named partition of an SDStorage file.
+ * @author Ferenc Mayer
+ * @date 2025-06-02
+ */
+
+#pragma once
+/**
+ * @brief Prevents multiple inclusions of the header file.
+ */
+
+#include "SDStorage.h"
+/**
+ * @brief Includes SDStorage, which owns the file, cache and partition table.
+ */
+
+/**
+ * @brief Named partition of an SDStorage file with its own address space.
+ * @details Addresses start at 0 and are checked against the partition length, so
+ *          a component cannot reach a neighbour's data. All partitions share the
+ *          parent's file handle and cache; flush() writes back the whole file in
+ *          one pass. The partition's flush policy, maxAge and cache quota come
+ *          from the table set with SDStorage::setPartitions().
+ */
+class SDPartition : public StorageBase {
+ private:
+  SDStorage &_storage;  ///< Storage holding the partition.
+  char _name[8];        ///< Partition name.
+  int8_t _index = -1;   ///< Index into the partition table, -1 until begin() succeeds.
+
+  /**
+   * @brief Returns the partition table entry.
+   * @return Entry, or nullptr if the partition is not resolved.
+   */
+  const SDStoragePartition *_entry() const;
+
+ protected:
+  /**
+   * @brief Reads an array of bytes from the partition.
+   * @param addr Starting address inside the partition.
+   * @param buffer Buffer to store read data.
+   * @param length Number of bytes to read.
+   * @return Pointer to the buffer, or nullptr if failed or address invalid.
+   */
+  uint8_t *readArray(uint16_t addr, uint8_t *buffer, uint16_t length) override;
+
+  /**
+   * @brief Writes an array of bytes to the partition.
+   * @param addr Starting address inside the partition.
+   * @param buffer Data to write.
+   * @param length Number of bytes to write.
+   * @return true if successful, false if failed or address invalid.
+   */
+  bool writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length) override;
+
+  /**
+   * @brief Updates an array of bytes, writing only changed bytes.
+   * @param addr Starting address inside the partition.
+   * @param buffer Data to write.
+   * @param length Number of bytes to update.
+   * @return true if successful, false otherwise.
+   */
+  bool updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length) override;
+
+ public:
+  /**
+   * @brief Constructs a partition view.
+   * @param storage Storage holding the partition (must outlive this object).
+   * @param name Partition name, up to 8 characters.
+   */
+  SDPartition(SDStorage &storage, const char *name);
+
+  /**
+   * @brief Looks up the partition in the storage's partition table.
+   * @details Call after SDStorage::begin() and again after SDStorage::setPartitions().
+   * @return true if the partition exists, false otherwise.
+   */
+  bool begin();
+
+  /**
+   * @brief Reads a single byte from the specified address.
+   * @param addr Address inside the partition.
+   * @return The byte read, or 0 if failed or address invalid.
+   */
+  uint8_t readu8(uint16_t addr) override;
+
+  /**
+   * @brief Writes a single byte to the specified address.
+   * @param addr Address inside the partition.
+   * @param val Byte to write.
+   * @return true if successful, false if failed or address invalid.
+   */
+  bool writeu8(uint16_t addr, uint8_t val) override;
+
+  /**
+   * @brief Updates a byte only if it differs from the current value.
+   * @param addr Address inside the partition.
+   * @param val Byte to write.
+   * @return true if successful or no write needed, false otherwise.
+   */
+  bool updateu8(uint16_t addr, uint8_t val) override;
+
+  /**
+   * @brief Fills the partition with the specified value, leaving other partitions untouched.
+   * @param v Byte value to fill.
+   * @return true if successful, false otherwise.
+   */
+  bool format(uint8_t v) override;
+
+  /**
+   * @brief Returns the size of the partition.
+   * @return Size in bytes, 0 if the partition is not resolved.
+   */
+  uint32_t getSize() override;
+
+  /**
+   * @brief Flushes pending writes of the whole storage file in one pass.
+   */
+  void flush() override;
+};
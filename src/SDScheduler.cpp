@@ -0,0 +1,88 @@
+#include "SDScheduler.h"
+
+#include "SDStorage.h"
+
+SDScheduler::SDScheduler(uint16_t burstPages) : _burstPages(burstPages) {}
+
+bool SDScheduler::attach(SDStorage *storage, uint8_t priority, uint32_t maxDelay) {
+  if (!storage || storage->_scheduler || _count == SDSCHEDULER_MAX_CLIENTS) return false;
+  _clients[_count].storage = storage;
+  _clients[_count].priority = priority;
+  _clients[_count].maxDelay = maxDelay;
+  _count++;
+  storage->_scheduler = this;
+  return true;
+}
+
+void SDScheduler::detach(SDStorage *storage) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_clients[i].storage != storage) continue;
+    storage->_scheduler = nullptr;
+    storage->flush();
+    for (uint8_t j = i + 1; j < _count; j++) {
+      _clients[j - 1] = _clients[j];
+    }
+    _count--;
+    if (_headClient >= _count) {
+      _headClient = 0;
+      _headOffset = 0;
+    }
+    return;
+  }
+}
+
+uint16_t SDScheduler::poll() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < _count; i++) {
+    SDStorage *s = _clients[i].storage;
+    if (s->_dirtySince && (int32_t)(now - s->_dirtySince) >= (int32_t)_clients[i].maxDelay) return run();
+  }
+  return 0;
+}
+
+uint16_t SDScheduler::run() {
+  if (!_count) return 0;
+  uint16_t written = 0;
+  uint32_t touched = 0;
+  int16_t level = 256;
+  while (true) {
+    // Next lower priority level that has registered instances.
+    int16_t next = -1;
+    for (uint8_t i = 0; i < _count; i++) {
+      if (_clients[i].priority < level && _clients[i].priority > next) next = _clients[i].priority;
+    }
+    if (next < 0) break;
+    level = next;
+    if (!_sweep(level, written, touched)) break;
+  }
+  for (uint8_t i = 0; i < _count; i++) {
+    SDStorage *s = _clients[i].storage;
+    if ((touched & (1UL << i)) || s->_update) s->_sync();
+  }
+  return written;
+}
+
+bool SDScheduler::_sweep(uint8_t priority, uint16_t &written, uint32_t &touched) {
+  // One lap over all instances starting at the elevator head; the head instance
+  // is visited twice, first above the head offset and, after the wrap, below it.
+  uint8_t startClient = _headClient;
+  uint32_t startOffset = _headOffset;
+  for (uint8_t step = 0; step <= _count; step++) {
+    uint8_t i = (startClient + step) % _count;
+    Client &c = _clients[i];
+    if (c.priority != priority) continue;
+    uint32_t from = (step == 0) ? startOffset : 0;
+    uint32_t until = (step == _count) ? startOffset : UINT32_MAX;
+    while (SDStorage::Page *p = c.storage->_nextDirty(from)) {
+      if (p->base >= until) break;
+      if (_burstPages && written >= _burstPages) return false;
+      if (!c.storage->_writeBack(p)) break;
+      touched |= 1UL << i;
+      written++;
+      from = p->base + c.storage->_tuning.pageSize;
+      _headClient = i;
+      _headOffset = from;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file SDScheduler.h
+ * @brief Header file for the SDScheduler class, coordinating write-backs of several SDStorage instances.
+ * @author Ferenc Mayer
+ * @date 2025-06-02
+ */
+
+#pragma once
+/**
+ * @brief Prevents multiple inclusions of the header file.
+ */
+
+#include <Arduino.h>
+/**
+ * @brief Includes Arduino core for millis().
+ */
+
+#ifndef SDSCHEDULER_MAX_CLIENTS
+#define SDSCHEDULER_MAX_CLIENTS 4  ///< Maximum number of SDStorage instances per scheduler (at most 32).
+#endif
+
+class SDStorage;
+
+/**
+ * @brief Shared write-back scheduler for SDStorage instances on one SD bus.
+ * @details Registered instances stop flushing on their own schedule. Their dirty
+ *          cache pages are collected and issued in bursts: highest priority first,
+ *          and within a priority level in one ascending sweep over (instance, file
+ *          offset) that resumes where the previous burst stopped (C-SCAN elevator).
+ *          Each touched file is flushed once per burst; uncached instances write
+ *          straight to the card and leave their flushes to the bursts as well.
+ *          The SD library does not expose cluster locations, so file order stands
+ *          in for physical order.
+ */
+class SDScheduler {
+ private:
+  /**
+   * @brief Registered instance.
+   */
+  struct Client {
+    SDStorage *storage; ///< Registered storage.
+    uint8_t priority;   ///< Higher values are written back first.
+    uint32_t maxDelay;  ///< Maximum age of dirty data in ms before poll() issues a burst.
+  };
+
+  Client _clients[SDSCHEDULER_MAX_CLIENTS]; ///< Registered instances.
+  uint8_t _count = 0;                       ///< Number of registered instances.
+  uint8_t _headClient = 0;                  ///< Elevator position: instance index.
+  uint32_t _headOffset = 0;                 ///< Elevator position: file offset inside that instance.
+  uint16_t _burstPages;                     ///< Page limit per burst (0 = unlimited).
+
+  /**
+   * @brief Writes back dirty pages of one priority level in elevator order.
+   * @param priority Priority level to service.
+   * @param written Pages written in this burst, updated.
+   * @param touched Bit mask of instances written to, updated.
+   * @return false if the burst page limit was reached, true otherwise.
+   */
+  bool _sweep(uint8_t priority, uint16_t &written, uint32_t &touched);
+
+ public:
+  /**
+   * @brief Constructs a scheduler.
+   * @param burstPages Maximum pages written per burst, bounds the stall of a single call (0 = unlimited).
+   */
+  explicit SDScheduler(uint16_t burstPages = 0);
+
+  /**
+   * @brief Registers a storage instance.
+   * @param storage Storage to register (must outlive the registration or detach itself).
+   * @param priority Write-back priority, higher values go first.
+   * @param maxDelay Maximum age of dirty data in ms before poll() writes it back.
+   * @return true if registered, false if the table is full or the storage is attached elsewhere.
+   */
+  bool attach(SDStorage *storage, uint8_t priority = 0, uint32_t maxDelay = 1000);
+
+  /**
+   * @brief Unregisters a storage instance after writing back its pending data.
+   * @param storage Storage to unregister.
+   */
+  void detach(SDStorage *storage);
+
+  /**
+   * @brief Issues a burst if any instance holds dirty data older than its maxDelay.
+   * @details Call from loop(). The burst services every pending instance, not just the due one.
+   * @return Number of pages written back.
+   */
+  uint16_t poll();
+
+  /**
+   * @brief Issues a burst over all pending instances.
+   * @return Number of pages written back.
+   */
+  uint16_t run();
+};
@@ -1,46 +1,411 @@
 #include "SDStorage.h"
 
+#include "SDScheduler.h"
+
 #define FILE_HEADER_SIZE 4
 
+#define META_MAGIC 0x4D534453UL  // "SDSM"
+#define META_VERSION 1
+#define META_HEADER_SIZE 8
+#define META_BLOCK_SIZE (META_HEADER_SIZE + sizeof(SDStorageTuning))
+
+#define PAGE_VALID 0x01
+#define PAGE_DIRTY 0x02
+#define PAGE_DEADLINE 0x04
+#define PAGE_PINNED 0x08
+
+#define SECTOR_SIZE 512
+#define WEAR_HEADER_SIZE 4
+
+#define RECOVERY_BACKOFF_MIN 100UL
+#define RECOVERY_BACKOFF_MAX 30000UL
+
+#define PARTITION_MAGIC 0x5450  // "PT"
+#define PARTITION_ENTRY_SIZE 18
+#define PARTITION_TABLE_SIZE (4 + SDSTORAGE_MAX_PARTITIONS * PARTITION_ENTRY_SIZE)
+
+#define BLOB_ENTRY_SIZE 16
+#define BLOB_TABLE_SIZE (SDSTORAGE_MAX_BLOBS * 2 * BLOB_ENTRY_SIZE)
+
+#define SCHEMA_MAGIC 0x4353  // "SC"
+#define SCHEMA_SIZE 4
+
+#define JOURNAL_MAGIC 0x4A4D4453UL  // "SDMJ"
+#define JOURNAL_HEADER_SIZE SDStorage::JOURNAL_HEADER
+#define JOURNAL_DATA 512
+
+#define CHECK_SEED 0xB10B
+
+#if SDSTORAGE_SEQLOCK
+// Writer side of the per-page seqlock: the sequence is odd while a page changes.
+#define SEQ_WRITE_BEGIN(p)                                            \
+  do {                                                                \
+    __atomic_store_n(&(p)->seq, (p)->seq + 1, __ATOMIC_RELAXED);      \
+    __atomic_thread_fence(__ATOMIC_RELEASE);                          \
+  } while (0)
+#define SEQ_WRITE_END(p) __atomic_store_n(&(p)->seq, (p)->seq + 1, __ATOMIC_RELEASE)
+// Batch log state read by readSnapshotCached() on another core.
+#define SEQ_PUBLISH(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#else
+#define SEQ_WRITE_BEGIN(p)
+#define SEQ_WRITE_END(p)
+#define SEQ_PUBLISH(var, value) ((var) = (value))
+#endif
+
+#define OP_NONE 0
+#define OP_FORMAT 1
+#define OP_UPDATE 2
+#define OP_VERIFY 3
+
+#define PROBE_SECTORS 8
+
+SDStorage::SharedFile SDStorage::_shared[SDSTORAGE_SHARED_FILES];
+uint8_t SDStorage::_cardGeneration = 0;
+
 SDStorage::SDStorage() {}
 
-SDStorage::~SDStorage() {}
+SDStorage::~SDStorage() {
+  if (_scheduler) _scheduler->detach(this);
+  while (_reads) cancelRead(*_reads);
+  _releaseCache();
+  free(_volatileRam);
+  free(_undo);
+  free(_wear);
+  free(_profile);
+  if (_sharedFile) _closeShared();
+}
 
 bool SDStorage::_seek(uint32_t addr) {
-  if (!_ee.seek(addr + FILE_HEADER_SIZE)) {
-    logger.error(F("seek failed to address: %i"), addr);
+  return _seekOffset(addr + FILE_HEADER_SIZE);
+}
+
+bool SDStorage::_seekOffset(uint32_t offset) {
+  if (_offline) return false;
+  _stats.seeks++;
+  if (!_ee.seek(offset)) {
+    // Past the end is a layout problem of the file, not a card failure.
+    if (offset > _ee.size()) {
+      SDSTORAGE_LOG_ERROR(F("seek past the end of '%s': %i"), _filename, offset);
+      _status = SDSTORAGE_ERR_ADDRESS;
+      return false;
+    }
+    uint8_t attempt = 0;
+    _pos = offset;
+    if (!_retry(SDSTORAGE_ERROR_SEEK, attempt, 0)) {
+      SDSTORAGE_LOG_IO(F("seek failed to offset: %i"), offset);
+      _fail();
+      return false;
+    }
+  }
+  _pos = offset;
+  return true;
+}
+
+bool SDStorage::_retry(SDStorageError error, uint8_t &attempt, uint16_t length) {
+  _stats.errors[error]++;
+  _event((SDStorageEventCode)error, _pos, length);
+  while (attempt < _config.retry.attempts && (_config.retry.classes & (1 << error))) {
+    delayMicroseconds(_config.retry.backoffUs << attempt);
+    attempt++;
+    _stats.retries++;
+    // The failed transfer may have moved the file position; resume at the first byte not done.
+    _stats.seeks++;
+    if (_ee.seek(_pos)) return true;
+    _stats.errors[SDSTORAGE_ERROR_SEEK]++;
+  }
+  return false;
+}
+
+int SDStorage::_read(uint8_t *buffer, uint16_t length, bool verify) {
+  uint16_t done = 0;
+  uint8_t attempt = 0;
+  while (done < length) {
+    int n = _ee.read(buffer + done, length - done);
+    if (n > 0) {
+      _pos += n;
+      done += n;
+      if (verify) {
+        _stats.verifyBytes += n;
+      } else {
+        _stats.readBytes += n;
+      }
+      continue;
+    }
+    if (n == 0 && _pos >= _ee.size()) break;  // End of file, not an error.
+    if (!_retry(n < 0 ? SDSTORAGE_ERROR_READ : SDSTORAGE_ERROR_SHORT_READ, attempt, length - done)) {
+      _fail();
+      return done ? done : -1;
+    }
+  }
+  if (attempt) _stats.retried++;
+  return done;
+}
+
+size_t SDStorage::_write(const uint8_t *buffer, uint16_t length) {
+  size_t done = 0;
+  uint8_t attempt = 0;
+  while (done < length) {
+    size_t n = _ee.write(buffer + done, length - done);
+    if (!n) {
+      if (!_retry(done ? SDSTORAGE_ERROR_SHORT_WRITE : SDSTORAGE_ERROR_WRITE, attempt, length - done)) {
+        _fail();
+        break;
+      }
+      continue;
+    }
+    done += n;
+    _stats.issuedBytes += n;
+    uint32_t first = _pos / SECTOR_SIZE;
+    uint32_t last = (_pos + n - 1) / SECTOR_SIZE;
+    _stats.sectorWrites += last - first + 1;
+    for (uint32_t sector = first; _wear && sector <= last && sector < _wearSectors; sector++) {
+      if (_wear[sector] == 0xFFFF) {
+        // Halve the whole table rather than widen it.
+        for (uint16_t i = 0; i < _wearSectors; i++) _wear[i] >>= 1;
+        _wearShift++;
+      }
+      _wear[sector]++;
+      _wearChanged = true;
+    }
+    _pos += n;
+  }
+  if (attempt && done == length) _stats.retried++;
+  return done;
+}
+
+void SDStorage::_event(SDStorageEventCode code, uint32_t offset, uint16_t length) {
+#if SDSTORAGE_EVENTS
+  if (_eventCount == SDSTORAGE_EVENTS) {
+    _stats.eventsLost++;
+  } else {
+    _eventCount++;
+  }
+  SDStorageEvent &e = _events[_eventHead];
+  e.time = millis();
+  e.offset = offset;
+  e.length = length;
+  e.code = code;
+  _eventHead = (_eventHead + 1) % SDSTORAGE_EVENTS;
+#else
+  (void)code;
+  (void)offset;
+  (void)length;
+#endif
+}
+
+bool SDStorage::readEvent(SDStorageEvent &event) {
+#if SDSTORAGE_EVENTS
+  if (!_eventCount) return false;
+  event = _events[(_eventHead + SDSTORAGE_EVENTS - _eventCount) % SDSTORAGE_EVENTS];
+  _eventCount--;
+  return true;
+#else
+  (void)event;
+  return false;
+#endif
+}
+
+void SDStorage::_fail() {
+  if (_offline) return;
+  _offline = true;
+  _offlineSince = millis();
+  _backoff = RECOVERY_BACKOFF_MIN;
+  _retryAt = _offlineSince + _backoff;
+  _stats.outages++;
+  _event(SDSTORAGE_EVENT_OFFLINE, _pos, 0);
+  SDSTORAGE_LOG_IO(F("SD card '%s' offline, keeping dirty data in RAM"), _filename);
+}
+
+bool SDStorage::_recover() {
+  if ((int32_t)(millis() - _retryAt) < 0) return false;
+  _ee = File();
+  bool ok;
+  if (_sharedFile) {
+    // The first reader to recover reopens the shared handle for all of them.
+    if (_sharedFile->generation == _sharedGeneration) {
+      ok = _restartCard() && (_sharedFile->file = _openFile(_filename, OPEN_READ));
+      if (ok) _sharedFile->generation++;
+    } else {
+      ok = true;
+    }
+    _ee = _sharedFile->file;
+    _sharedGeneration = _sharedFile->generation;
+  } else {
+    ok = _restartCard() && (_ee = _openFile(_filename, OPEN_UPDATE));
+  }
+  uint32_t s = 0;
+  ok = ok && _ee.seek(0) && _ee.read((uint8_t *)&s, sizeof(s)) == sizeof(s) && s == _size;
+  if (ok) {
+    _offline = false;
+    // Replay the write-backs that failed during the outage.
+    if (!_config.readOnly) flush();
+    ok = !_offline;
+  }
+  if (!ok) {
+    _offline = true;
+    _backoff = (_backoff >= RECOVERY_BACKOFF_MAX / 2) ? RECOVERY_BACKOFF_MAX : _backoff * 2;
+    _retryAt = millis() + _backoff;
     return false;
   }
+  uint32_t outage = millis() - _offlineSince;
+  _stats.recoveries++;
+  _stats.lastRecoveryMs = outage;
+  _stats.downtimeMs += outage;
+  _event(SDSTORAGE_EVENT_RECOVERED, 0, (outage / 1000 > 0xFFFF) ? 0xFFFF : outage / 1000);
+  SDSTORAGE_LOG_DEBUG(F("SD card '%s' recovered after %i ms"), _filename, outage);
+  return true;
+}
+
+bool SDStorage::_restartCard() {
+#if SDSTORAGE_FS
+  // fs::FS instances recover through their own filesystem and never touch the SD library.
+  if (_fs) return !_config.remount || _config.remount(*_fs, _config.remountContext);
+#endif
+  // Another instance on the same card may have restarted it already.
+  if (_cardGeneration != _cardSeen) {
+    _cardSeen = _cardGeneration;
+    return true;
+  }
+  SD.end();
+  if (!SD.begin(_pin)) return false;
+  _cardSeen = ++_cardGeneration;
   return true;
 }
 
+File SDStorage::_openFile(const char *path, uint8_t mode) {
+#if SDSTORAGE_FS
+  static const char *const modes[] = {"r", "r+", "w"};
+#if SDSTORAGE_SD_IS_FS
+  // The ESP32 SD library is an fs::FS and takes the same mode strings.
+  fs::FS &fs = _fs ? *_fs : SD;
+  return fs.open(path, modes[mode]);
+#else
+  if (_fs) return _fs->open(path, modes[mode]);
+#endif
+#endif
+#if !SDSTORAGE_SD_IS_FS
+  return SD.open(path, (mode == OPEN_READ) ? O_READ : (mode == OPEN_UPDATE) ? O_RDWR : O_WRITE | O_CREAT);
+#endif
+}
+
+bool SDStorage::_fileExists(const char *path) {
+#if SDSTORAGE_FS
+  if (_fs) return _fs->exists(path);
+#endif
+  return SD.exists(path);
+}
+
+bool SDStorage::_removeFile(const char *path) {
+#if SDSTORAGE_FS
+  if (_fs) return _fs->remove(path);
+#endif
+  return SD.remove(path);
+}
+
+bool SDStorage::_makeDir(const char *path) {
+#if SDSTORAGE_FS
+  if (_fs) return _fs->mkdir(path);
+#endif
+  return SD.mkdir(path);
+}
+
+bool SDStorage::isOnline() const {
+  return !_offline;
+}
+
+void SDStorage::_flushFile() {
+  _ee.flush();
+  _stats.flushes++;
+}
+
 bool SDStorage::begin(size_t size, const char *filename, int pin) {
+  return begin(size, filename, pin, SDStorageConfig());
+}
+
+bool SDStorage::begin(size_t size, const char *filename, int pin, const SDStorageConfig &config) {
+  _releaseCache();
+  _config = config;
+  _pin = pin;
+  _offline = false;
+  _cardSeen = _cardGeneration;
+#if SDSTORAGE_FS
+  _fs = nullptr;
+#endif
   if (SD.begin(pin)) {
-    logger.debug(F("SD begin success"));
-    return open(size, filename);
+    SDSTORAGE_LOG_DEBUG(F("SD begin success"));
+    return _mount(size, filename);
   } else {
-    logger.error(F("SD begin failed"));
+    SDSTORAGE_LOG_ERROR(F("SD begin failed"));
     return false;
   }
 }
 
+#if SDSTORAGE_FS
+bool SDStorage::begin(size_t size, const char *filename, fs::FS &fs, const SDStorageConfig &config) {
+  _releaseCache();
+  _config = config;
+  _offline = false;
+  _cardSeen = _cardGeneration;
+  _fs = &fs;
+  return _mount(size, filename);
+}
+#endif
+
+bool SDStorage::_mount(size_t size, const char *filename) {
+  for (uint8_t i = 0; !_config.cachePages && i < _config.regionCount; i++) {
+    // Without cache pages nothing holds dirty data, so a deadline could never apply.
+    if (_config.regions[i].policy == SDSTORAGE_WRITE_BACK && _config.regions[i].maxAge) {
+      SDSTORAGE_LOG_ERROR(F("region addr=%d has a maxAge but no cache pages are configured"), _config.regions[i].start);
+      return false;
+    }
+  }
+  if (!open(size, filename)) return false;
+  if (_config.trackWear && !_config.readOnly && !_wear) {
+    _wearSectors = (FILE_HEADER_SIZE + _size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    _wear = (uint16_t *)calloc(_wearSectors, sizeof(uint16_t));
+    if (!_wear) {
+      SDSTORAGE_LOG_ERROR(F("wear table allocation failed"));
+      _wearSectors = 0;
+    } else if (!_loadWear()) {
+      _saveWear();
+    }
+  }
+  if (_config.snapshotBytes && !_config.readOnly && !_undo) {
+    _undo = (uint8_t *)malloc(_config.snapshotBytes);
+    if (!_undo) SDSTORAGE_LOG_ERROR(F("snapshot log allocation failed"));
+  }
+  if (_config.profileLine && !_profile) {
+    _profileLines = (_size + _config.profileLine - 1) / _config.profileLine;
+    _profile = (uint16_t *)calloc(_profileLines * 2, sizeof(uint16_t));
+    if (!_profile) {
+      SDSTORAGE_LOG_ERROR(F("profile allocation failed"));
+      _profileLines = 0;
+    }
+  }
+  if (_config.calibrate && !_config.readOnly && _tuning.singleWriteUs == 0 && !calibrate()) {
+    SDSTORAGE_LOG_ERROR(F("calibration of '%s' failed, using defaults"), _filename);
+  }
+  return _initVolatile(-1) && _allocCache();
+}
+
 bool SDStorage::open(uint32_t size, const char *filename) {
   if (strlen(filename) > 12) {
-    logger.error(F("file '%s' name is too long, max 12 character allowed"), filename);
+    SDSTORAGE_LOG_ERROR(F("file '%s' name is too long, max 12 character allowed"), filename);
     return false;
   }
   strcpy(_filename, filename);
   uint8_t ret = 0;
   _size = size;
-  if (!SD.exists(_filename)) {
-    logger.debug(F("file '%s' does not exists, create and format it..."), _filename);
+  if (_config.readOnly) return _openShared();
+  if (!_fileExists(_filename)) {
+    SDSTORAGE_LOG_DEBUG(F("file '%s' does not exists, create and format it..."), _filename);
     ret = format('\0');
     if (ret) {
-      logger.debug(F("file '%s' formatted successfully!"), _filename);
+      SDSTORAGE_LOG_DEBUG(F("file '%s' formatted successfully!"), _filename);
       return ret;
     }
   } else {
-    _ee = SD.open(_filename, O_RDWR);
+    _ee = _openFile(_filename, OPEN_UPDATE);
     if (!_ee) return false;
     uint32_t s;
     _ee.seek(0);
@@ -48,158 +413,1857 @@ bool SDStorage::open(uint32_t size, const char *filename) {
     if (_ee.read(s32, 4) == 4) {
       memcpy(&s, s32, sizeof(s));
       if (s != _size) {
-        logger.debug(F("reformatting '%s' file to size %i ..."), _filename, size);
+        SDSTORAGE_LOG_DEBUG(F("reformatting '%s' file to size %i ..."), _filename, size);
         ret = format('\0');
         if (ret) {
-          logger.debug(F("file '%s' formatted successfully!"), _filename);
+          SDSTORAGE_LOG_DEBUG(F("file '%s' formatted successfully!"), _filename);
           return ret;
         }
       }
     } else {
-      logger.error(F("Read error: addr=0 length=4 !"));
+      SDSTORAGE_LOG_ERROR(F("Read error: addr=0 length=4 !"));
       return false;
     }
+    // format() of earlier versions left the file 512 bytes short of its data area.
+    if (!_extendTo(FILE_HEADER_SIZE + _size)) {
+      SDSTORAGE_LOG_ERROR(F("cannot extend '%s' to its size"), _filename);
+      return false;
+    }
+    if (!_loadMeta()) {
+      SDSTORAGE_LOG_DEBUG(F("file '%s' has no metadata block, using default tuning"), _filename);
+    }
+    _loadPartitions();
+    _loadBlobs();
+    _loadSchema();
+    _replayJournal();
   }
-  logger.debug(F("file '%s' opened successfully!"), _filename);
+  SDSTORAGE_LOG_DEBUG(F("file '%s' opened successfully!"), _filename);
   return 1;
 }
 
 void SDStorage::close() {
+  if (_sharedFile) {
+    _closeShared();
+    return;
+  }
+  _writeBackDirty();
+  if (_wearChanged) _saveWear();
   _ee.flush();
   _ee.close();
 }
 
-bool SDStorage::format(uint8_t v) {
-  if (_ee) _ee.close();
-  if (SD.exists(_filename)) {
-    SD.remove(_filename);
-  }
-  _ee = SD.open(_filename, O_WRITE | O_CREAT);
-  if (_ee) {
-    size_t a;
-    a = (_size < 512) ? _size : 512;
-    uint8_t val[a];
-    for (size_t i = 0; i < a; i++) {
-      val[i] = v;
-    }
-    for (size_t i = 0; i < _size - a; i += a) {
-      _ee.write(val, a);
-      _ee.flush();
-    }
-    _ee.close();
-    _ee = SD.open(_filename, O_RDWR);
-    _ee.seek(0);
-    uint8_t s[4];
-    memcpy(s, &_size, sizeof(_size));
-    _ee.write(s, sizeof(_size));
-    flush();
-    return true;
-  } else {
+bool SDStorage::_openShared() {
+  SharedFile *slot = nullptr;
+  for (uint8_t i = 0; i < SDSTORAGE_SHARED_FILES; i++) {
+#if SDSTORAGE_FS
+    if (_shared[i].refs && strcmp(_shared[i].name, _filename) == 0 && _shared[i].fs == _fs) {
+#else
+    if (_shared[i].refs && strcmp(_shared[i].name, _filename) == 0) {
+#endif
+      slot = &_shared[i];
+      break;
+    }
+    if (!slot && !_shared[i].refs) slot = &_shared[i];
+  }
+  if (!slot) {
+    SDSTORAGE_LOG_ERROR(F("no free shared handle for '%s'"), _filename);
     return false;
   }
-}
+  if (!slot->refs) {
+    slot->file = _openFile(_filename, OPEN_READ);
+    if (!slot->file) {
+      SDSTORAGE_LOG_ERROR(F("file '%s' cannot be opened read-only"), _filename);
+      return false;
+    }
+    strcpy(slot->name, _filename);
+    slot->image = nullptr;
+#if SDSTORAGE_FS
+    slot->fs = _fs;
+#endif
+  }
+  slot->refs++;
+  _sharedFile = slot;
+  _sharedGeneration = slot->generation;
+  _ee = slot->file;
 
-uint32_t SDStorage::getSize() {
-  return _size;
+  uint32_t s;
+  _ee.seek(0);
+  if (_ee.read((uint8_t *)&s, sizeof(s)) != sizeof(s) || s != _size) {
+    SDSTORAGE_LOG_ERROR(F("file '%s' does not hold a %i byte image"), _filename, _size);
+    _closeShared();
+    return false;
+  }
+  _loadMeta();
+  _loadPartitions();
+  _loadBlobs();
+  _loadSchema();
+  if (_config.cacheImage && !slot->image) {
+    slot->image = (uint8_t *)malloc(_size);
+    if (slot->image && (!_seek(0) || _ee.read(slot->image, _size) != (int)_size)) {
+      SDSTORAGE_LOG_ERROR(F("Read error: addr=0 length=%i"), _size);
+      free(slot->image);
+      slot->image = nullptr;
+    }
+  }
+  _image = slot->image;
+  SDSTORAGE_LOG_DEBUG(F("file '%s' opened read-only (%i readers)"), _filename, slot->refs);
+  return true;
 }
 
-void SDStorage::flush() {
-  _ee.flush();
-  _update = 0;
+void SDStorage::_closeShared() {
+  _image = nullptr;
+  _ee = File();
+  if (--_sharedFile->refs == 0) {
+    _sharedFile->file.close();
+    _sharedFile->file = File();
+    free(_sharedFile->image);
+    _sharedFile->image = nullptr;
+    _sharedFile->name[0] = '\0';
+    _sharedFile->generation++;
+  }
+  _sharedFile = nullptr;
 }
 
-uint8_t SDStorage::readu8(uint16_t addr) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE)) return 0;
-  if (_seek(addr)) {
-    return _ee.read();
-  } else {
-    return 0;
+bool SDStorage::_loadMeta() {
+  uint32_t offset = FILE_HEADER_SIZE + _size;
+  if (_ee.size() < offset + META_BLOCK_SIZE) return false;
+  if (!_seekOffset(offset)) return false;
+  uint8_t header[META_HEADER_SIZE];
+  if (_read(header, META_HEADER_SIZE) != META_HEADER_SIZE) return false;
+  uint32_t magic;
+  uint16_t version;
+  memcpy(&magic, header, sizeof(magic));
+  memcpy(&version, header + 4, sizeof(version));
+  if (magic != META_MAGIC || version != META_VERSION) return false;
+  SDStorageTuning tuning;
+  if (_read((uint8_t *)&tuning, sizeof(tuning)) != (int)sizeof(tuning)) return false;
+  if (tuning.pageSize < 512 || (tuning.pageSize & (tuning.pageSize - 1)) || tuning.batchPages == 0) return false;
+  while (tuning.pageSize > SDSTORAGE_MAX_PAGE_SIZE) {
+    tuning.pageSize >>= 1;
+    tuning.batchPages <<= 1;
   }
+  _tuning = tuning;
+  return true;
 }
-bool SDStorage::writeu8(uint16_t addr, uint8_t val) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE)) return false;
-  _update++;
-  if (!_seek(addr)) return false;
-  if (_ee.write(val) != 1) return false;
-  if (_update == 512) {
-    flush();
+
+bool SDStorage::_saveMeta() {
+  if (!_seekOffset(FILE_HEADER_SIZE + _size)) return false;
+  uint8_t header[META_HEADER_SIZE];
+  uint32_t magic = META_MAGIC;
+  uint16_t version = META_VERSION;
+  uint16_t length = sizeof(SDStorageTuning);
+  memcpy(header, &magic, sizeof(magic));
+  memcpy(header + 4, &version, sizeof(version));
+  memcpy(header + 6, &length, sizeof(length));
+  if (_write(header, META_HEADER_SIZE) != META_HEADER_SIZE) return false;
+  return _write((const uint8_t *)&_tuning, sizeof(_tuning)) == sizeof(_tuning);
+}
+
+uint32_t SDStorage::_partitionOffset() {
+  uint32_t sectors = (FILE_HEADER_SIZE + _size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  return FILE_HEADER_SIZE + _size + META_BLOCK_SIZE + WEAR_HEADER_SIZE + sectors * sizeof(uint16_t);
+}
+
+uint32_t SDStorage::_metaSize() {
+  return _partitionOffset() + PARTITION_TABLE_SIZE + BLOB_TABLE_SIZE + SCHEMA_SIZE - FILE_HEADER_SIZE - _size;
+}
+
+bool SDStorage::_loadWear() {
+  uint32_t offset = FILE_HEADER_SIZE + _size + META_BLOCK_SIZE;
+  if (_ee.size() < _partitionOffset()) return false;
+  uint16_t header[2];
+  if (!_seekOffset(offset) || _read((uint8_t *)header, sizeof(header)) != sizeof(header)) return false;
+  if (header[0] != _wearSectors) return false;
+  if (_read((uint8_t *)_wear, _wearSectors * sizeof(uint16_t)) != (int)(_wearSectors * sizeof(uint16_t))) {
+    memset(_wear, 0, _wearSectors * sizeof(uint16_t));
+    return false;
   }
-  return (readu8(addr) == val);
+  _wearShift = header[1];
+  return true;
 }
 
-bool SDStorage::updateu8(uint16_t addr, uint8_t val) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE)) return false;
-  if (readu8(addr) == val) return true;
-  writeu8(addr, val);
-  return (readu8(addr) == val);
+bool SDStorage::_saveWear() {
+  if (!_wear) return true;
+  _wearChanged = false;
+  uint16_t header[2] = {_wearSectors, _wearShift};
+  // A file in the original layout ends after the data area.
+  if (!_extendTo(_partitionOffset())) return false;
+  if (!_seekOffset(FILE_HEADER_SIZE + _size + META_BLOCK_SIZE)) return false;
+  // Written with the raw file API so persisting the table does not count as wear.
+  if (_ee.write((const uint8_t *)header, sizeof(header)) != sizeof(header)) return false;
+  return _ee.write((const uint8_t *)_wear, _wearSectors * sizeof(uint16_t)) == _wearSectors * sizeof(uint16_t);
 }
 
-uint8_t *SDStorage::readArray(uint16_t addr, uint8_t *buffer, uint16_t length) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return nullptr;
-  _seek(addr);
-  if (_ee.read(buffer, length) != (int)length) {
-    logger.error(F("Read error: addr=%d length=%d"), addr, length);
+bool SDStorage::_loadPartitions() {
+  _partitionCount = 0;
+  uint32_t offset = _partitionOffset();
+  if (_ee.size() < offset + PARTITION_TABLE_SIZE) return false;
+  uint16_t header[2];
+  if (!_seekOffset(offset) || _read((uint8_t *)header, sizeof(header)) != sizeof(header)) return false;
+  if (header[0] != PARTITION_MAGIC || header[1] > SDSTORAGE_MAX_PARTITIONS) return false;
+  for (uint8_t i = 0; i < header[1]; i++) {
+    uint8_t entry[PARTITION_ENTRY_SIZE];
+    if (_read(entry, sizeof(entry)) != sizeof(entry)) return false;
+    SDStoragePartition &p = _partitions[i];
+    memcpy(p.name, entry, sizeof(p.name));
+    memcpy(&p.region.start, entry + 8, 2);
+    memcpy(&p.region.length, entry + 10, 2);
+    memcpy(&p.region.maxAge, entry + 12, 4);
+    p.region.policy = (SDStoragePolicy)entry[16];
+    p.cachePages = entry[17];
   }
-  return buffer;
+  _partitionCount = header[1];
+  return true;
 }
 
-bool SDStorage::writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
-  if ((_update + length) >= 512) {
-    flush();
+bool SDStorage::_savePartitions() {
+  uint32_t offset = _partitionOffset();
+  // The wear table in front of the partition table is only written when tracked.
+  if (!_extendTo(offset)) return false;
+  uint16_t header[2] = {PARTITION_MAGIC, _partitionCount};
+  if (!_seekOffset(offset) || _write((const uint8_t *)header, sizeof(header)) != sizeof(header)) return false;
+  for (uint8_t i = 0; i < SDSTORAGE_MAX_PARTITIONS; i++) {
+    uint8_t entry[PARTITION_ENTRY_SIZE] = {};
+    if (i < _partitionCount) {
+      const SDStoragePartition &p = _partitions[i];
+      memcpy(entry, p.name, sizeof(p.name));
+      memcpy(entry + 8, &p.region.start, 2);
+      memcpy(entry + 10, &p.region.length, 2);
+      memcpy(entry + 12, &p.region.maxAge, 4);
+      entry[16] = p.region.policy;
+      entry[17] = p.cachePages;
+    }
+    if (_write(entry, sizeof(entry)) != sizeof(entry)) return false;
   }
-  if (!_seek(addr)) return false;
-  if (_ee.write(buffer, length) != length) return false;
-  _update += length;
-  if (_update >= 512) {
-    flush();
+  return true;
+}
+
+bool SDStorage::setPartitions(const SDStoragePartition *partitions, uint8_t count) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (_busy()) return false;
+  if (count > SDSTORAGE_MAX_PARTITIONS) {
+    SDSTORAGE_LOG_ERROR(F("too many partitions: %i, max %i"), count, SDSTORAGE_MAX_PARTITIONS);
+    return false;
+  }
+  uint32_t start = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (partitions[i].region.policy == SDSTORAGE_VOLATILE) {
+      SDSTORAGE_LOG_ERROR(F("partition '%.8s' cannot be volatile"), partitions[i].name);
+      return false;
+    }
+    if (partitions[i].region.policy == SDSTORAGE_WRITE_BACK && partitions[i].region.maxAge && !_config.cachePages) {
+      SDSTORAGE_LOG_ERROR(F("partition '%.8s' has a maxAge but no cache pages are configured"), partitions[i].name);
+      return false;
+    }
+    for (uint8_t j = 0; j < i; j++) {
+      if (strncmp(partitions[i].name, partitions[j].name, sizeof(partitions[i].name)) == 0) {
+        SDSTORAGE_LOG_ERROR(F("duplicate partition '%.8s'"), partitions[i].name);
+        return false;
+      }
+    }
+    start += partitions[i].region.length;
+  }
+  if (!isValidAddress(FILE_HEADER_SIZE, start)) {
+    SDSTORAGE_LOG_ERROR(F("partitions need %i bytes, %i available"), start, _size - FILE_HEADER_SIZE);
+    return false;
+  }
+  flush();
+  start = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    _partitions[i] = partitions[i];
+    _partitions[i].region.start = start;
+    start += partitions[i].region.length;
   }
-  return verifyArray(addr, buffer, length);
+  _partitionCount = count;
+  bool ret = _savePartitions();
+  _flushFile();
+  return ret;
 }
 
-bool SDStorage::updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
+void SDStorage::_loadBlobs() {
+  memset(_blobs, 0, sizeof(_blobs));
+  uint32_t offset = _partitionOffset() + PARTITION_TABLE_SIZE;
+  if (_ee.size() < offset + BLOB_TABLE_SIZE || !_seekOffset(offset)) return;
+  for (uint8_t i = 0; i < SDSTORAGE_MAX_BLOBS; i++) {
+    // Each blob has two copies of its entry; the valid one with the newer generation wins.
+    bool valid[2];
+    BlobEntry copies[2];
+    for (uint8_t c = 0; c < 2; c++) {
+      uint8_t entry[BLOB_ENTRY_SIZE];
+      valid[c] = _read(entry, sizeof(entry)) == sizeof(entry);
+      uint16_t check;
+      memcpy(&check, entry + 14, 2);
+      valid[c] = valid[c] && check == _checkWord(entry, BLOB_ENTRY_SIZE - 2);
+      memcpy(copies[c].name, entry, 8);
+      memcpy(&copies[c].size, entry + 8, 4);
+      copies[c].generation = entry[12];
+      copies[c].used = entry[13];
+    }
+    uint8_t c = (valid[1] && (!valid[0] || (int8_t)(copies[1].generation - copies[0].generation) > 0)) ? 1 : 0;
+    if (!valid[c]) continue;
+    _blobs[i] = copies[c];
+    _blobs[i].copy = c;
+  }
+}
+
+bool SDStorage::_saveBlob(uint8_t slot, uint8_t copy) {
+  uint32_t offset = _partitionOffset() + PARTITION_TABLE_SIZE + ((uint32_t)slot * 2 + copy) * BLOB_ENTRY_SIZE;
+  // The partition table in front of the blob table may not have been written yet, and
+  // _loadBlobs() only reads a complete table.
+  if (_ee.size() < _partitionOffset() + PARTITION_TABLE_SIZE && !_savePartitions()) return false;
+  if (!_extendTo(_partitionOffset() + PARTITION_TABLE_SIZE + BLOB_TABLE_SIZE)) return false;
+  const BlobEntry &b = _blobs[slot];
+  uint8_t entry[BLOB_ENTRY_SIZE];
+  memcpy(entry, b.name, 8);
+  memcpy(entry + 8, &b.size, 4);
+  entry[12] = b.generation;
+  entry[13] = b.used;
+  uint16_t check = _checkWord(entry, BLOB_ENTRY_SIZE - 2);
+  memcpy(entry + 14, &check, 2);
+  return _seekOffset(offset) && _write(entry, sizeof(entry)) == sizeof(entry);
+}
 
-  uint8_t current[length];
-  readArray(addr, current, length);
+uint16_t SDStorage::_checkWord(const uint8_t *data, uint8_t length) {
+  uint16_t sum = CHECK_SEED;
+  for (uint8_t i = 0; i < length; i++) sum = (sum << 1 | sum >> 15) ^ data[i];
+  return sum;
+}
 
-  uint16_t start = 0;
-  bool in_diff = false;
-  for (uint16_t i = 0; i < length; i++) {
-    if (current[i] != buffer[i]) {
-      if (!in_diff) {
-        start = i;
-        in_diff = true;
-      }
-    } else if (in_diff) {
-      if (!writeArray(addr + start, buffer + start, i - start)) {
-        logger.error(F("Write error: addr=%d, length=%d"), addr + start, i - start);
-        return false;
-      }
-      in_diff = false;
+bool SDStorage::_commitBlob(const char *name, uint32_t size, uint8_t generation, bool used) {
+  if (_busy()) return false;
+  int8_t slot = _findBlob(name);
+  if (slot < 0) {
+    for (uint8_t i = 0; i < SDSTORAGE_MAX_BLOBS && slot < 0; i++) {
+      if (!_blobs[i].used) slot = i;
     }
   }
+  if (slot < 0) {
+    SDSTORAGE_LOG_ERROR(F("no free blob slot for '%.8s', max %i"), name, SDSTORAGE_MAX_BLOBS);
+    return false;
+  }
+  // Overwrite the stale copy; the current one stays intact until this write is complete.
+  BlobEntry previous = _blobs[slot];
+  BlobEntry &b = _blobs[slot];
+  strncpy(b.name, name, sizeof(b.name));
+  b.size = size;
+  b.generation = generation;
+  b.used = used;
+  b.copy = previous.copy ^ 1;
+  if (!_saveBlob(slot, b.copy)) {
+    _blobs[slot] = previous;
+    return false;
+  }
+  // A new blob starts over at generation 0, which need not outrank the entry left in a free
+  // slot by format() or a removal, so that copy is overwritten too. If this second write
+  // fails, the blob may be gone after the next begin(), like an interrupted commit.
+  if (!previous.used) {
+    _flushFile();
+    _saveBlob(slot, previous.copy);
+  }
+  _flushFile();
+  return true;
+}
+
+bool SDStorage::_extendTo(uint32_t end) {
+  if (_ee.size() >= end) return true;
+  if (!_seekOffset(_ee.size())) return false;
+  uint8_t zero[16] = {};
+  for (uint32_t pos = _ee.size(); pos < end;) {
+    uint16_t n = (end - pos < sizeof(zero)) ? end - pos : sizeof(zero);
+    if (_write(zero, n) != n) return false;
+    pos += n;
+  }
+  return true;
+}
+
+void SDStorage::_loadSchema() {
+  _schema = 0;
+  uint32_t offset = _partitionOffset() + PARTITION_TABLE_SIZE + BLOB_TABLE_SIZE;
+  uint16_t record[2];
+  if (_ee.size() < offset + SCHEMA_SIZE || !_seekOffset(offset) || _read((uint8_t *)record, sizeof(record)) != sizeof(record)) return;
+  if (record[0] == SCHEMA_MAGIC) _schema = record[1];
+}
+
+bool SDStorage::_saveSchema() {
+  uint32_t offset = _partitionOffset() + PARTITION_TABLE_SIZE + BLOB_TABLE_SIZE;
+  uint16_t record[2] = {SCHEMA_MAGIC, _schema};
+  return _extendTo(offset) && _seekOffset(offset) && _write((const uint8_t *)record, sizeof(record)) == sizeof(record);
+}
+
+uint32_t SDStorage::_journalOffset() {
+  // Shares the calibration scratch region; calibrate() refuses to run while a journal is pending.
+  return (FILE_HEADER_SIZE + _size + _metaSize() + SECTOR_SIZE - 1) & ~(uint32_t)(SECTOR_SIZE - 1);
+}
+
+bool SDStorage::_replayJournal() {
+  uint32_t journal = _journalOffset();
+  uint8_t header[JOURNAL_HEADER_SIZE];
+  if (_ee.size() < journal + JOURNAL_HEADER_SIZE || !_seekOffset(journal) || _read(header, sizeof(header)) != sizeof(header)) return false;
+  uint32_t magic;
+  uint16_t version, start, length, check;
+  memcpy(&magic, header, 4);
+  memcpy(&version, header + 4, 2);
+  memcpy(&start, header + 6, 2);
+  memcpy(&length, header + 8, 2);
+  memcpy(&check, header + 10, 2);
+  if (magic != JOURNAL_MAGIC || check != _checkWord(header, JOURNAL_HEADER_SIZE - 2)) return false;
+  if (!isValidAddress((uint32_t)start + FILE_HEADER_SIZE, length)) return false;
+
+  // Redo the copy; repeating it after a power loss is harmless.
+  uint8_t chunk[SDSTORAGE_CHUNK_SIZE];
+  for (uint16_t done = 0; done < length;) {
+    uint16_t n = ((uint32_t)(length - done) < sizeof(chunk)) ? length - done : sizeof(chunk);
+    if (!_seekOffset(journal + JOURNAL_DATA + done) || _read(chunk, n) != (int)n) return false;
+    if (!_seek(start + done) || _write(chunk, n) != n) return false;
+    done += n;
+  }
+  _flushFile();
+  _schema = version;
+  if (!_saveSchema()) return false;
+  _flushFile();
+  memset(header, 0, sizeof(header));
+  if (!_seekOffset(journal) || _write(header, sizeof(header)) != sizeof(header)) return false;
+  _flushFile();
+
+  // Drop stale copies of the rewritten range, then pin the reloaded pages again.
+  uint32_t from = start + FILE_HEADER_SIZE, to = from + length;
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if (!(p->flags & PAGE_VALID) || !_overlaps(p, from, to)) continue;
+    SEQ_WRITE_BEGIN(p);
+    p->flags = 0;
+    SEQ_WRITE_END(p);
+  }
+  _loadPins();
+  if (_volatileRam) _initVolatile(-1);
+  _changed(start, length);
+  SDSTORAGE_LOG_DEBUG(F("file '%s' switched to schema %i"), _filename, version);
+  return true;
+}
+
+bool SDStorage::_journalPending() {
+  uint32_t journal = _journalOffset();
+  uint32_t magic;
+  return _ee.size() >= journal + JOURNAL_HEADER_SIZE && _seekOffset(journal) && _read((uint8_t *)&magic, sizeof(magic)) == sizeof(magic) &&
+         magic == JOURNAL_MAGIC;
+}
+
+uint16_t SDStorage::getSchemaVersion() const {
+  return _schema;
+}
+
+bool SDStorage::migrate(const SDStorageMigration *steps, uint8_t count) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (_busy()) return false;
+  uint8_t first = 0;
+  while (first < count && steps[first].version <= _schema) first++;
+  if (first == count) return true;
+  uint32_t begin = millis();
+  uint32_t lo = 0xFFFF, hi = 0;
+  for (uint8_t i = first; i < count; i++) {
+    if (steps[i].start < lo) lo = steps[i].start;
+    if ((uint32_t)steps[i].start + steps[i].length > hi) hi = (uint32_t)steps[i].start + steps[i].length;
+  }
+  if (hi <= lo || !isValidAddress(lo + FILE_HEADER_SIZE, hi - lo)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  flush();
 
-  if (in_diff) {
-    if (!writeArray(addr + start, buffer + start, length - start)) {
-      logger.error(F("Write error: addr=%d, length=%d"), addr + start, length - start);
+  // Build the new image of the affected range in the journal, one streaming pass.
+  SDStorageMigrationSource source;
+  source._storage = this;
+  source._steps = steps + first;
+  source._level = count - first;
+  uint32_t journal = _journalOffset();
+  if (!_extendTo(journal + JOURNAL_DATA + (hi - lo))) return false;
+  uint8_t chunk[SDSTORAGE_CHUNK_SIZE];
+  for (uint32_t a = lo; a < hi;) {
+    uint16_t n = (hi - a < sizeof(chunk)) ? hi - a : sizeof(chunk);
+    if (!source.read(a, chunk, n)) {
+      SDSTORAGE_LOG_ERROR(F("migration to schema %i failed at addr=%i"), steps[count - 1].version, a);
       return false;
     }
+    if (!_seekOffset(journal + JOURNAL_DATA + (a - lo)) || _write(chunk, n) != n) return false;
+    a += n;
+  }
+  _flushFile();
+
+  // The valid journal header is the switch: from here on the new image wins, even after a reset.
+  uint8_t header[JOURNAL_HEADER_SIZE];
+  uint32_t magic = JOURNAL_MAGIC;
+  uint16_t version = steps[count - 1].version, start = lo, length = hi - lo;
+  memcpy(header, &magic, 4);
+  memcpy(header + 4, &version, 2);
+  memcpy(header + 6, &start, 2);
+  memcpy(header + 8, &length, 2);
+  uint16_t check = _checkWord(header, JOURNAL_HEADER_SIZE - 2);
+  memcpy(header + 10, &check, 2);
+  if (!_seekOffset(journal) || _write(header, sizeof(header)) != sizeof(header)) return false;
+  _flushFile();
+  if (!_replayJournal()) return false;
+  _stats.migrationMs = millis() - begin;
+  SDSTORAGE_LOG_DEBUG(F("migrated '%s' to schema %i in %i ms"), _filename, version, _stats.migrationMs);
+  return true;
+}
+
+bool SDStorageMigrationSource::read(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  if (!_level) return _storage->_transfer(addr, buffer, length, false);
+  // Ranges the step changes come from its build function, the rest from the version before.
+  const SDStorageMigration &step = _steps[_level - 1];
+  SDStorageMigrationSource previous = *this;
+  previous._level--;
+  uint32_t from = step.start, to = (uint32_t)step.start + step.length;
+  while (length) {
+    uint16_t n = length;
+    bool changed = addr >= from && addr < to;
+    if (changed) {
+      if (to - addr < n) n = to - addr;
+    } else if (addr < from && from - addr < n) {
+      n = from - addr;
+    }
+    if (changed ? !step.build(previous, addr, buffer, n, step.context) : !previous.read(addr, buffer, n)) return false;
+    addr += n;
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+int8_t SDStorage::_findBlob(const char *name) {
+  for (uint8_t i = 0; i < SDSTORAGE_MAX_BLOBS; i++) {
+    if (_blobs[i].used && strncmp(_blobs[i].name, name, sizeof(_blobs[i].name)) == 0) return i;
   }
+  return -1;
+}
 
-  return verifyArray(addr, buffer, length);
+int8_t SDStorage::_findPartition(const char *name) {
+  for (uint8_t i = 0; i < _partitionCount; i++) {
+    if (strncmp(_partitions[i].name, name, sizeof(_partitions[i].name)) == 0) return i;
+  }
+  return -1;
 }
 
-bool SDStorage::verifyArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
-  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
-  uint8_t read_buffer[length];
-  if (!readArray(addr, read_buffer, length)) {
-    logger.error(F("Read error: addr=%d, length=%d"), addr, length);
+bool SDStorage::calibrate() {
+  if (_config.readOnly || !_ee || _busy()) return false;
+  // The scratch region doubles as the migration journal.
+  if (_journalPending()) {
+    SDSTORAGE_LOG_ERROR(F("'%s' has a pending migration journal, not calibrating"), _filename);
     return false;
   }
-  if (memcmp(read_buffer, buffer, length) != 0) {
+  _releaseCache();
+  _ee.flush();
+
+  uint32_t scratch = (FILE_HEADER_SIZE + _size + _metaSize() + PROBE_SECTOR - 1) & ~(uint32_t)(PROBE_SECTOR - 1);
+  uint32_t end = scratch + (uint32_t)PROBE_SECTOR * PROBE_SECTORS;
+  uint8_t sector[PROBE_SECTOR];
+
+  // Extend the file so the scratch region exists, seek cannot go past the end. A short
+  // data area and the metadata are zero-filled; only the scratch region gets the pattern.
+  if (!_seekOffset(_ee.size())) return false;
+  for (uint32_t pos = _ee.size(); pos < end;) {
+    uint32_t limit = (pos < scratch) ? scratch : end;
+    uint16_t n = (limit - pos < PROBE_SECTOR) ? limit - pos : PROBE_SECTOR;
+    memset(sector, (pos < scratch) ? 0 : 0xA5, n);
+    if (_ee.write(sector, n) != n) return false;
+    pos += n;
+  }
+  _ee.flush();
+  memset(sector, 0xA5, sizeof(sector));
+
+  uint32_t t;
+  uint32_t single = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    t = micros();
+    if (!_seekOffset(scratch + (uint32_t)i * 2 * PROBE_SECTOR)) return false;
+    _ee.write(sector, PROBE_SECTOR);
+    _ee.flush();
+    single += micros() - t;
+  }
+  single /= 4;
+
+  t = micros();
+  if (!_seekOffset(scratch)) return false;
+  for (uint8_t i = 0; i < PROBE_SECTORS; i++) {
+    _ee.write(sector, PROBE_SECTOR);
+  }
+  _ee.flush();
+  uint32_t multi = (micros() - t) / PROBE_SECTORS;
+
+  uint32_t read = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    t = micros();
+    if (!_seekOffset(scratch + (uint32_t)(7 - i * 2) * PROBE_SECTOR)) return false;
+    _ee.read(sector, PROBE_SECTOR);
+    read += micros() - t;
+  }
+  read /= 4;
+
+  t = micros();
+  if (!_seekOffset(scratch)) return false;
+  _ee.write(sector, 1);
+  _ee.flush();
+  uint32_t flushCost = micros() - t;
+
+  // A card whose single-sector writes cost much more than a sector inside a
+  // burst has large internal pages: grow the page size, then the batch.
+  uint32_t ratio = (multi && single > multi) ? single / multi : 1;
+  uint16_t pageSize = 512;
+  while (pageSize < SDSTORAGE_MAX_PAGE_SIZE && (uint32_t)(pageSize / 512) * 2 <= ratio) pageSize <<= 1;
+  uint32_t batch = ratio * 512 / pageSize;
+  batch = (batch < 1) ? 1 : (batch > 8) ? 8 : batch;
+  // Keep the flush overhead around 10% of the time spent writing.
+  uint32_t threshold = multi ? flushCost * 10 * 512 / multi : 512;
+  threshold = (threshold < pageSize) ? pageSize : (threshold > 32768) ? 32768 : threshold;
+
+  _tuning.pageSize = pageSize;
+  _tuning.batchPages = batch;
+  _tuning.flushThreshold = threshold;
+  _tuning.singleWriteUs = single ? single : 1;
+  _tuning.multiWriteUs = multi;
+  _tuning.readUs = read;
+  _tuning.flushUs = flushCost;
+  SDSTORAGE_LOG_DEBUG(F("calibrated '%s': write %ius, burst %ius/sector, read %ius, flush %ius -> page %i, batch %i, threshold %i"),
+               _filename, single, multi, read, flushCost, pageSize, (int)batch, (int)threshold);
+
+  bool ret = _saveMeta();
+  _ee.flush();
+  if (!ret) return false;
+  return _allocCache();
+}
+
+void SDStorage::poll() {
+  if (_offline && !_recover()) return;
+  if (_reads && _op.kind != OP_FORMAT) _serviceReads();
+  if (_waiters) {
+    // Waiters deferred by these callbacks run on the next poll().
+    SDStorageWaiter *w = _waiters;
+    _waiters = nullptr;
+    while (w) {
+      SDStorageWaiter *next = w->next;
+      w->next = nullptr;
+      w->callback(w);
+      w = next;
+    }
+  }
+  for (SDStorageWatch *w = _watches; w;) {
+    SDStorageWatch *next = w->next;
+    if (w->callback && w->version != w->notified) {
+      uint16_t addr = w->changedAddr, length = w->changedLength;
+      w->notified = w->version;
+      w->changedLength = 0;
+      w->callback(w, addr, length, w->notified, w->context);
+    }
+    w = next;
+  }
+  uint32_t now = millis();
+  bool written = false;
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if ((p->flags & PAGE_DEADLINE) && (int32_t)(now - p->deadline) >= 0) {
+      if (!_writeBack(p)) return;
+      written = true;
+    }
+  }
+  if (written) _flushFile();
+}
+
+bool SDStorage::readArrayAsync(uint16_t addr, uint8_t *buffer, uint16_t length, SDStorageFuture &future,
+                               SDStorageReadCallback callback, void *context) {
+  for (SDStorageFuture *f = _reads; f; f = f->next) {
+    if (f == &future) return false;
+  }
+  future.addr = addr;
+  future.buffer = buffer;
+  future.length = length;
+  future.callback = callback;
+  future.context = context;
+  future.next = nullptr;
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) {
+    _completeRead(&future, SDSTORAGE_ERR_ADDRESS);
     return false;
   }
+  if (_op.kind != OP_FORMAT && _resident(addr, length)) {
+    _completeRead(&future, _transfer(addr, buffer, length, false) ? SDSTORAGE_OK : SDSTORAGE_ERR_IO);
+    return true;
+  }
+  future.status = SDSTORAGE_IN_PROGRESS;
+  SDStorageFuture **link = &_reads;
+  while (*link && (*link)->addr <= addr) link = &(*link)->next;
+  future.next = *link;
+  *link = &future;
+  return true;
+}
+
+void SDStorage::cancelRead(SDStorageFuture &future) {
+  for (SDStorageFuture **link = &_reads; *link; link = &(*link)->next) {
+    if (*link != &future) continue;
+    *link = future.next;
+    future.next = nullptr;
+    future.status = SDSTORAGE_ERR_IO;
+    return;
+  }
+}
+
+void SDStorage::defer(SDStorageWaiter &waiter) {
+  SDStorageWaiter **link = &_waiters;
+  while (*link) link = &(*link)->next;
+  waiter.next = nullptr;
+  *link = &waiter;
+}
+
+bool SDStorage::watch(SDStorageWatch &watch, uint16_t addr, uint16_t length, SDStorageWatchCallback callback, void *context) {
+  if (!length || !isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
+  for (SDStorageWatch *w = _watches; w; w = w->next) {
+    if (w == &watch) return false;
+  }
+  watch.addr = addr;
+  watch.length = length;
+  watch.callback = callback;
+  watch.context = context;
+  watch.notified = watch.version;
+  watch.changedLength = 0;
+  watch.batchLength = 0;
+  watch.next = _watches;
+  _watches = &watch;
+  return true;
+}
+
+void SDStorage::unwatch(SDStorageWatch &watch) {
+  for (SDStorageWatch **link = &_watches; *link; link = &(*link)->next) {
+    if (*link != &watch) continue;
+    *link = watch.next;
+    watch.next = nullptr;
+    return;
+  }
+}
+
+void SDStorage::_changed(uint16_t addr, uint32_t length) {
+  uint32_t end = (uint32_t)addr + length;
+  for (SDStorageWatch *w = _watches; w; w = w->next) {
+    uint32_t watchEnd = (uint32_t)w->addr + w->length;
+    if (w->addr >= end || watchEnd <= addr) continue;
+    uint32_t from = (addr > w->addr) ? addr : w->addr;
+    uint32_t to = (end < watchEnd) ? end : watchEnd;
+    if (_batch) {
+      _cover(w->batchAddr, w->batchLength, from, to);
+    } else {
+      _cover(w->changedAddr, w->changedLength, from, to);
+      w->version = w->version + 1;
+    }
+  }
+}
+
+void SDStorage::_cover(uint16_t &addr, uint16_t &length, uint32_t from, uint32_t to) {
+  if (length) {
+    if (addr < from) from = addr;
+    if ((uint32_t)addr + length > to) to = (uint32_t)addr + length;
+  }
+  addr = from;
+  length = to - from;
+}
+
+#if SDSTORAGE_COROUTINES
+SDStorageAwait SDStorage::readAwait(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  return SDStorageAwait(*this, SDStorageAwait::READ, addr, buffer, length);
+}
+
+SDStorageAwait SDStorage::writeAwait(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  return SDStorageAwait(*this, SDStorageAwait::WRITE, addr, const_cast<uint8_t *>(buffer), length);
+}
+
+SDStorageAwait SDStorage::updateAwait(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  return SDStorageAwait(*this, SDStorageAwait::UPDATE, addr, const_cast<uint8_t *>(buffer), length);
+}
+
+SDStorageAwait SDStorage::flushAwait() {
+  return SDStorageAwait(*this, SDStorageAwait::FLUSH, 0, nullptr, 0);
+}
+
+SDStorageAwait::SDStorageAwait(SDStorage &storage, Op op, uint16_t addr, uint8_t *buffer, uint16_t length)
+    : _storage(storage), _op(op) {
+  _future.addr = addr;
+  _future.buffer = buffer;
+  _future.length = length;
+  _waiter.callback = _onPoll;
+  _waiter.context = this;
+}
+
+bool SDStorageAwait::await_ready() {
+  if (_op == READ) {
+    _storage.readArrayAsync(_future.addr, _future.buffer, _future.length, _future, _onRead, this);
+    return _future.ready();
+  }
+  // A flush always yields to the poll loop.
+  return _op != FLUSH && _issue();
+}
+
+void SDStorageAwait::await_suspend(std::coroutine_handle<> handle) {
+  _handle = handle;
+  if (_op != READ) _storage.defer(_waiter);
+}
+
+SDStorageStatus SDStorageAwait::await_resume() const {
+  return _future.status;
+}
+
+bool SDStorageAwait::_issue() {
+  switch (_op) {
+    case WRITE:
+      _storage.writeArray(_future.addr, _future.buffer, _future.length);
+      break;
+    case UPDATE:
+      _storage.updateArray(_future.addr, _future.buffer, _future.length);
+      break;
+    default:
+      _storage.flush();
+      _storage._status = _storage._offline ? SDSTORAGE_ERR_OFFLINE : SDSTORAGE_OK;
+      break;
+  }
+  _future.status = _storage._status;
+  return _future.status != SDSTORAGE_IN_PROGRESS;
+}
+
+void SDStorageAwait::_onRead(SDStorageFuture *, void *context) {
+  SDStorageAwait *self = (SDStorageAwait *)context;
+  if (self->_handle) self->_handle.resume();
+}
+
+void SDStorageAwait::_onPoll(SDStorageWaiter *waiter) {
+  SDStorageAwait *self = (SDStorageAwait *)waiter->context;
+  if (self->_issue()) {
+    self->_handle.resume();
+  } else {
+    self->_storage.defer(self->_waiter);
+  }
+}
+#endif
+
+bool SDStorage::beginBatch() {
+  if (!_undo || _batch) return false;
+  _batch = true;
+  _implicitBatch = false;
+  SEQ_PUBLISH(_batchOverflow, false);
+  SEQ_PUBLISH(_undoUsed, 0);
+#if SDSTORAGE_SEQLOCK
+  SEQ_PUBLISH(_batchSeq, _batchSeq + 1);
+#endif
+  return true;
+}
+
+void SDStorage::commitBatch() {
+  if (!_batch) return;
+#if SDSTORAGE_SEQLOCK
+  // Readers that copied during the batch retry before the log is reused.
+  __atomic_store_n(&_batchSeq, _batchSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+  _batch = false;
+  _implicitBatch = false;
+  SEQ_PUBLISH(_batchOverflow, false);
+  SEQ_PUBLISH(_undoUsed, 0);
+  for (SDStorageWatch *w = _watches; w; w = w->next) {
+    if (!w->batchLength) continue;
+    _cover(w->changedAddr, w->changedLength, w->batchAddr, (uint32_t)w->batchAddr + w->batchLength);
+    w->batchLength = 0;
+    w->version = w->version + 1;
+  }
+}
+
+void SDStorage::_undoRecord(uint16_t addr, uint16_t length) {
+  // Record layout: address, old bytes, length (walked backwards by readSnapshot()).
+  if ((uint32_t)_undoUsed + length + 4 > _config.snapshotBytes) {
+    SEQ_PUBLISH(_batchOverflow, true);
+    return;
+  }
+  uint8_t *record = _undo + _undoUsed;
+  memcpy(record, &addr, 2);
+  if (!_transfer(addr, record + 2, length, false)) {
+    SEQ_PUBLISH(_batchOverflow, true);
+    return;
+  }
+  memcpy(record + 2 + length, &length, 2);
+  // Published before the write changes the page, so a reader that sees the new bytes also sees the old ones.
+  SEQ_PUBLISH(_undoUsed, _undoUsed + length + 4);
+}
+
+uint8_t *SDStorage::readSnapshot(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  if (_batch && _batchOverflow) {
+    _status = SDSTORAGE_IN_PROGRESS;
+    return nullptr;
+  }
+  if (!readArray(addr, buffer, length)) return nullptr;
+  _overlayUndo(addr, buffer, length, _batch ? _undoUsed : 0);
+  return buffer;
+}
+
+bool SDStorage::readSnapshotCached(uint16_t addr, uint8_t *buffer, uint16_t length) {
+#if SDSTORAGE_SEQLOCK
+  for (;;) {
+    uint32_t seq = __atomic_load_n(&_batchSeq, __ATOMIC_ACQUIRE);
+    if (!readCached(addr, buffer, length)) return false;
+    bool ok = true;
+    if (seq & 1) {
+      // Every write the copy saw had its old bytes logged before it changed the page.
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      ok = !__atomic_load_n(&_batchOverflow, __ATOMIC_ACQUIRE);
+      if (ok) _overlayUndo(addr, buffer, length, __atomic_load_n(&_undoUsed, __ATOMIC_ACQUIRE));
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&_batchSeq, __ATOMIC_RELAXED) == seq) return ok;
+  }
+#else
+  if (_batch && _batchOverflow) return false;
+  if (!readCached(addr, buffer, length)) return false;
+  _overlayUndo(addr, buffer, length, _batch ? _undoUsed : 0);
+  return true;
+#endif
+}
+
+void SDStorage::_overlayUndo(uint16_t addr, uint8_t *buffer, uint16_t length, uint16_t used) {
+  // Newest record first so the oldest value wins.
+  for (uint16_t end = used; end;) {
+    uint16_t n, at;
+    memcpy(&n, _undo + end - 2, 2);
+    uint16_t data = end - 2 - n;
+    memcpy(&at, _undo + data - 2, 2);
+    uint32_t lo = (addr > at) ? addr : at;
+    uint32_t hi = ((uint32_t)addr + length < (uint32_t)at + n) ? (uint32_t)addr + length : (uint32_t)at + n;
+    if (lo < hi) memcpy(buffer + (lo - addr), _undo + data + (lo - at), hi - lo);
+    end = data - 2;
+  }
+}
+
+bool SDStorage::_modify(uint16_t addr, uint8_t size, ModifyOp op, uint32_t operand, uint32_t compare, uint32_t &old) {
+  old = 0;
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, size)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  if (_busy()) return false;
+  _status = SDSTORAGE_OK;
+  // Values are stored little-endian like read<T>()/write<T>() on all supported targets.
+  uint8_t bytes[4];
+  if (!_transfer(addr, bytes, size, false)) return false;
+  for (uint8_t i = size; i--;) old = (old << 8) | bytes[i];
+  uint32_t mask = (size == 4) ? 0xFFFFFFFFUL : (1UL << (size * 8)) - 1;
+  uint32_t value;
+  switch (op) {
+    case MODIFY_CAS:
+      if (old != (compare & mask)) return false;
+      value = operand;
+      break;
+    case MODIFY_ADD:
+      value = old + operand;
+      break;
+    case MODIFY_OR:
+      value = old | operand;
+      break;
+    default:
+      value = old & operand;
+      break;
+  }
+  value &= mask;
+  if (value == old) return true;
+  for (uint8_t i = 0; i < size; i++) bytes[i] = value >> (i * 8);
+  _stats.logicalBytes += size;
+  if (_batch && !_batchOverflow) _undoRecord(addr, size);
+  if (!_transfer(addr, bytes, size, true)) return false;
+  _changed(addr, size);
+  return true;
+}
+
+bool SDStorage::readCached(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
+  if (_image) {
+    memcpy(buffer, _image + addr, length);
+    return true;
+  }
+  uint32_t offset = addr + FILE_HEADER_SIZE;
+  while (length) {
+    uint16_t in = offset & (_tuning.pageSize - 1);
+    uint16_t n = (length < _tuning.pageSize - in) ? length : _tuning.pageSize - in;
+    if (!_copyPage(offset - in, in, buffer, n)) return false;
+    offset += n;
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool SDStorage::_copyPage(uint32_t base, uint16_t in, uint8_t *buffer, uint16_t length) {
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+#if SDSTORAGE_SEQLOCK
+    for (;;) {
+      uint32_t seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+      bool hit = (p->flags & PAGE_VALID) && p->base == base;
+      if (seq & 1) {
+        // Only wait for a writer that holds, or is loading, the wanted page.
+        if (p->base == base) continue;
+        break;
+      }
+      if (hit) memcpy(buffer, p->data + in, length);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq) continue;
+      if (hit) return true;
+      break;
+    }
+#else
+    if ((p->flags & PAGE_VALID) && p->base == base) {
+      memcpy(buffer, p->data + in, length);
+      return true;
+    }
+#endif
+  }
+  return false;
+}
+
+bool SDStorage::_resident(uint16_t addr, uint16_t length) {
+  if (_image) return true;
+  while (length) {
+    uint16_t n = length;
+    const SDStorageRegion *r = _region(addr, n);
+    if (!r || r->policy != SDSTORAGE_VOLATILE) {
+      uint32_t end = (uint32_t)addr + n + FILE_HEADER_SIZE;
+      for (uint32_t base = (addr + FILE_HEADER_SIZE) & ~(uint32_t)(_tuning.pageSize - 1); base < end; base += _tuning.pageSize) {
+        bool found = false;
+        for (uint8_t i = 0; i < _pageCount && !found; i++) {
+          found = (_pages[i].flags & PAGE_VALID) && _pages[i].base == base;
+        }
+        if (!found) return false;
+      }
+    }
+    addr += n;
+    length -= n;
+  }
+  return true;
+}
+
+void SDStorage::_serviceReads() {
+  uint32_t begin = micros();
+  while (_reads && _op.kind != OP_FORMAT) {
+    // Group the first read with every queued read starting in a sector it touches.
+    SDStorageFuture *first = _reads, *last = _reads;
+    uint32_t from = first->addr, to = from + first->length;
+    while (last->next && ((uint32_t)last->next->addr + FILE_HEADER_SIZE) / SECTOR_SIZE <= (to + FILE_HEADER_SIZE - 1) / SECTOR_SIZE) {
+      last = last->next;
+      if ((uint32_t)last->addr + last->length > to) to = (uint32_t)last->addr + last->length;
+    }
+    _reads = last->next;
+    last->next = nullptr;
+
+    // One sequential pass over the union, copied out to each request.
+    uint8_t chunk[SDSTORAGE_CHUNK_SIZE];
+    bool ok = true;
+    for (uint32_t a = from; ok && a < to;) {
+      uint16_t n = (to - a < sizeof(chunk)) ? to - a : sizeof(chunk);
+      ok = _transfer(a, chunk, n, false);
+      for (SDStorageFuture *f = first; ok && f; f = f->next) {
+        uint32_t lo = (a > f->addr) ? a : f->addr;
+        uint32_t hi = ((uint32_t)f->addr + f->length < a + n) ? (uint32_t)f->addr + f->length : a + n;
+        if (lo < hi) memcpy(f->buffer + (lo - f->addr), chunk + (lo - a), hi - lo);
+      }
+      a += n;
+    }
+    SDStorageStatus status = ok ? SDSTORAGE_OK : (_offline ? SDSTORAGE_ERR_OFFLINE : SDSTORAGE_ERR_IO);
+    while (first) {
+      SDStorageFuture *next = first->next;
+      first->next = nullptr;
+      _completeRead(first, status);
+      first = next;
+    }
+    if (_timeBudget && micros() - begin >= _timeBudget) break;
+  }
+}
+
+void SDStorage::_completeRead(SDStorageFuture *future, SDStorageStatus status) {
+  future->status = status;
+  if (future->callback) future->callback(future, future->context);
+}
+
+const SDStorageStats &SDStorage::getStats() const {
+  return _stats;
+}
+
+void SDStorage::resetStats() {
+  _stats = SDStorageStats();
+}
+
+float SDStorage::getWriteAmplification() const {
+  if (!_stats.logicalBytes) return 0;
+  return (float)(_stats.sectorWrites + _stats.flushes) * SECTOR_SIZE / _stats.logicalBytes;
+}
+
+uint32_t SDStorage::getModelTime() const {
+  uint32_t sectorsRead = (_stats.readBytes + _stats.verifyBytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  return _stats.sectorWrites * _tuning.multiWriteUs + sectorsRead * _tuning.readUs + _stats.flushes * _tuning.flushUs;
+}
+
+void SDStorage::printStats(Print &out, const char *scenario) const {
+  // Field names stay in flash on AVR.
+  struct Field {
+    static void print(Print &out, const __FlashStringHelper *name, uint32_t value) {
+      out.print(F(",\""));
+      out.print(name);
+      out.print(F("\":"));
+      out.print(value);
+    }
+  };
+  out.print(F("{\"scenario\":\""));
+  out.print(scenario);
+  out.print('"');
+  Field::print(out, F("logicalBytes"), _stats.logicalBytes);
+  Field::print(out, F("issuedBytes"), _stats.issuedBytes);
+  Field::print(out, F("sectorWrites"), _stats.sectorWrites);
+  Field::print(out, F("readBytes"), _stats.readBytes);
+  Field::print(out, F("verifyBytes"), _stats.verifyBytes);
+  Field::print(out, F("flushes"), _stats.flushes);
+  Field::print(out, F("seeks"), _stats.seeks);
+  Field::print(out, F("retries"), _stats.retries);
+  Field::print(out, F("modelUs"), getModelTime());
+  Field::print(out, F("ms"), millis());
+#if SDSTORAGE_LATENCY
+  out.print(F(",\"latency\":["));
+  for (uint8_t i = 0; i < SDSTORAGE_LATENCY_BUCKETS; i++) {
+    if (i) out.print(',');
+    out.print(_stats.latency[i]);
+  }
+  out.print(']');
+#endif
+  out.println('}');
+}
+
+SDStorageFootprint SDStorage::getFootprint() const {
+  uint16_t volatileBytes = 0;
+  for (uint8_t i = 0; _volatileRam && i < _config.regionCount; i++) {
+    if (_config.regions[i].policy == SDSTORAGE_VOLATILE) volatileBytes += _config.regions[i].length;
+  }
+  return footprint(_size, _pageCount, _tuning.pageSize, _undo ? _config.snapshotBytes : 0, volatileBytes, _wear != nullptr,
+                   _profile ? _config.profileLine : 0, _image != nullptr, _config.calibrate && !_config.readOnly);
+}
+
+uint32_t SDStorage::getSectorWrites(uint16_t sector) const {
+  if (!_wear || sector >= _wearSectors) return 0;
+  return (uint32_t)_wear[sector] << _wearShift;
+}
+
+void SDStorage::printProfile(Print &out) const {
+  out.print(F("# line="));
+  out.print(_config.profileLine);
+  out.print(F(" size="));
+  out.print(_size);
+  out.print(F(" page="));
+  out.println(_tuning.pageSize);
+  for (uint16_t i = 0; i < _profileLines; i++) {
+    if (!_profile[i * 2] && !_profile[i * 2 + 1]) continue;
+    out.print(i);
+    out.print(',');
+    out.print(_profile[i * 2]);
+    out.print(',');
+    out.println(_profile[i * 2 + 1]);
+  }
+}
+
+void SDStorage::resetProfile() {
+  if (_profile) memset(_profile, 0, _profileLines * 2 * sizeof(uint16_t));
+}
+
+void SDStorage::printWear(Print &out) const {
+  for (uint16_t i = 0; i < _wearSectors; i++) {
+    out.print(i);
+    out.print(',');
+    out.println(getSectorWrites(i));
+  }
+}
+
+SDStorageStatus SDStorage::getStatus() const {
+  return _status;
+}
+
+const SDStorageTuning &SDStorage::getTuning() const {
+  return _tuning;
+}
+
+bool SDStorage::_allocCache() {
+  if (_pages || !_config.cachePages) return true;
+  _pages = (Page *)calloc(_config.cachePages, sizeof(Page));
+  if (!_pages) {
+    SDSTORAGE_LOG_ERROR(F("cache allocation failed"));
+    return false;
+  }
+  for (_pageCount = 0; _pageCount < _config.cachePages; _pageCount++) {
+    _pages[_pageCount].data = (uint8_t *)malloc(_tuning.pageSize);
+    if (!_pages[_pageCount].data) break;
+  }
+  if (!_pageCount) {
+    SDSTORAGE_LOG_ERROR(F("cache allocation failed"));
+    free(_pages);
+    _pages = nullptr;
+    return false;
+  }
+  if (_pageCount < _config.cachePages) {
+    SDSTORAGE_LOG_ERROR(F("cache reduced to %i pages"), _pageCount);
+  }
+  _loadPins();
+  return true;
+}
+
+void SDStorage::_loadPins() {
+  if (!_pageCount) return;
+  // Start over, so a reload after format() or a migration pins the same pages as begin().
+  for (uint8_t i = 0; i < _pageCount; i++) _pages[i].flags &= ~PAGE_PINNED;
+  uint8_t pinned = 0;
+  for (uint8_t i = 0; i < _config.pinCount; i++) {
+    uint16_t addr = _config.pins[i];
+    if (!isValidAddress(addr + FILE_HEADER_SIZE)) continue;
+    // One page always stays evictable.
+    if (pinned + 1 >= _pageCount) {
+      SDSTORAGE_LOG_ERROR(F("pin list exceeds the cache, %i pages pinned"), pinned);
+      return;
+    }
+    Page *p = _page(addr + FILE_HEADER_SIZE);
+    if (!p) return;
+    if (!(p->flags & PAGE_PINNED)) pinned++;
+    p->flags |= PAGE_PINNED;
+  }
+}
+
+void SDStorage::_releaseCache() {
+  if (!_pages) return;
+  _writeBackDirty();
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    free(_pages[i].data);
+  }
+  free(_pages);
+  _pages = nullptr;
+  _pageCount = 0;
+}
+
+uint16_t SDStorage::_pageLength(uint32_t base) {
+  uint32_t end = FILE_HEADER_SIZE + _size;
+  return (end - base < _tuning.pageSize) ? end - base : _tuning.pageSize;
+}
+
+bool SDStorage::_overlaps(const Page *page, uint32_t from, uint32_t to) {
+  return page->base < to && page->base + _tuning.pageSize > from;
+}
+
+SDStorage::Page *SDStorage::_victim(uint32_t from, uint32_t to) {
+  Page *victim = nullptr;
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if (p->flags & PAGE_PINNED) continue;
+    if (to && (!(p->flags & PAGE_VALID) || !_overlaps(p, from, to))) continue;
+    if (!(p->flags & PAGE_VALID)) {
+      if (!victim || (victim->flags & PAGE_VALID)) victim = p;
+    } else if (!victim || ((victim->flags & PAGE_VALID) && p->stamp < victim->stamp)) {
+      victim = p;
+    }
+  }
+  return victim;
+}
+
+SDStorage::Page *SDStorage::_page(uint32_t offset, bool load) {
+  uint32_t base = offset & ~(uint32_t)(_tuning.pageSize - 1);
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if ((p->flags & PAGE_VALID) && p->base == base) {
+      p->stamp = ++_clock;
+      return p;
+    }
+  }
+  // A partition at its cache quota evicts one of its own pages. Pages straddling the
+  // partition boundary count towards the quota.
+  Page *victim = nullptr;
+  if (_active && _active->cachePages) {
+    uint32_t from = _active->region.start + FILE_HEADER_SIZE;
+    uint32_t to = from + _active->region.length;
+    uint8_t held = 0;
+    for (uint8_t i = 0; i < _pageCount; i++) {
+      if ((_pages[i].flags & PAGE_VALID) && _overlaps(&_pages[i], from, to)) held++;
+    }
+    if (held >= _active->cachePages) victim = _victim(from, to);
+  }
+  // Below the quota, or every page of the partition is pinned: global LRU.
+  if (!victim) victim = _victim(0, 0);
+  if (!victim) {
+    SDSTORAGE_LOG_ERROR(F("no evictable cache page, all %i pinned"), _pageCount);
+    return nullptr;
+  }
+  if (victim->flags & PAGE_DIRTY) {
+    if (!_writeBackDirty(_tuning.batchPages, victim->base)) return nullptr;
+  }
+  SEQ_WRITE_BEGIN(victim);
+  victim->flags = 0;
+  victim->base = base;
+  if (load) {
+    uint16_t length = _pageLength(base);
+    if (!_seekOffset(base) || _read(victim->data, length) != (int)length) {
+      SEQ_WRITE_END(victim);
+      SDSTORAGE_LOG_IO(F("Read error: offset=%d length=%d"), base, length);
+      return nullptr;
+    }
+  }
+  victim->flags = PAGE_VALID;
+  SEQ_WRITE_END(victim);
+  victim->stamp = ++_clock;
+  return victim;
+}
+
+bool SDStorage::_writeBack(Page *page) {
+  uint16_t length = _pageLength(page->base);
+  if (!_seekOffset(page->base)) return false;
+  if (_write(page->data, length) != length) {
+    SDSTORAGE_LOG_IO(F("Write error: offset=%d, length=%d"), page->base, length);
+    return false;
+  }
+  if (!_verifyDirect(page->base, page->data, length)) return false;
+  page->flags &= ~(PAGE_DIRTY | PAGE_DEADLINE);
+  return true;
+}
+
+SDStorage::Page *SDStorage::_nextDirty(uint32_t from) {
+  Page *next = nullptr;
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if ((p->flags & PAGE_DIRTY) && p->base >= from && (!next || p->base < next->base)) next = p;
+  }
+  return next;
+}
+
+bool SDStorage::_writeBackDirty(uint16_t max, uint32_t from) {
+  for (uint16_t n = 0; !max || n < max; n++) {
+    Page *next = _nextDirty(from);
+    if (!next) break;
+    if (!_writeBack(next)) return false;
+    from = next->base + _tuning.pageSize;
+  }
+  return true;
+}
+
+const SDStorageRegion *SDStorage::_region(uint16_t addr, uint16_t &length) {
+  const SDStorageRegion *hit = nullptr;
+  uint32_t end = (uint32_t)addr + length;
+  // Explicit regions first, then the partitions' flush policies.
+  for (uint8_t i = 0; i < _config.regionCount + _partitionCount; i++) {
+    const SDStorageRegion *r = (i < _config.regionCount) ? &_config.regions[i] : &_partitions[i - _config.regionCount].region;
+    uint32_t rend = (uint32_t)r->start + r->length;
+    if (addr >= r->start && addr < rend) {
+      if (!hit) hit = r;
+      if (rend < end) end = rend;
+    } else if (r->start > addr && r->start < end) {
+      end = r->start;
+    }
+  }
+  length = end - addr;
+  return hit;
+}
+
+uint8_t *SDStorage::_volatile(const SDStorageRegion *region, uint16_t addr) {
+  uint32_t offset = 0;
+  for (const SDStorageRegion *r = _config.regions; r != region; r++) {
+    if (r->policy == SDSTORAGE_VOLATILE) offset += r->length;
+  }
+  return _volatileRam + offset + (addr - region->start);
+}
+
+bool SDStorage::_initVolatile(int16_t fill) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < _config.regionCount; i++) {
+    const SDStorageRegion *r = &_config.regions[i];
+    if (r->policy != SDSTORAGE_VOLATILE) continue;
+    if (!isValidAddress((uint32_t)r->start + FILE_HEADER_SIZE, r->length)) {
+      SDSTORAGE_LOG_ERROR(F("region addr=%d length=%d is out of range"), r->start, r->length);
+      return false;
+    }
+    total += r->length;
+  }
+  if (!total) return true;
+  if (!_volatileRam) {
+    _volatileRam = (uint8_t *)malloc(total);
+    if (!_volatileRam) {
+      SDSTORAGE_LOG_ERROR(F("volatile region allocation failed"));
+      return false;
+    }
+  }
+  if (fill >= 0) {
+    memset(_volatileRam, fill, total);
+    return true;
+  }
+  for (uint8_t i = 0; i < _config.regionCount; i++) {
+    const SDStorageRegion *r = &_config.regions[i];
+    if (r->policy != SDSTORAGE_VOLATILE) continue;
+    if (!_seek(r->start) || _read(_volatile(r, r->start), r->length) != (int)r->length) {
+      SDSTORAGE_LOG_ERROR(F("Read error: addr=%d length=%d"), r->start, r->length);
+      return false;
+    }
+  }
+  return true;
+}
+
+void SDStorage::_profileAccess(uint16_t addr, uint16_t length, bool write) {
+  uint16_t last = ((uint32_t)addr + length - 1) / _config.profileLine;
+  for (uint16_t line = addr / _config.profileLine; line <= last && line < _profileLines; line++) {
+    uint16_t &count = _profile[line * 2 + (write ? 1 : 0)];
+    if (count != 0xFFFF) count++;
+  }
+}
+
+bool SDStorage::_transfer(uint16_t addr, uint8_t *buffer, uint16_t length, bool write) {
+#if SDSTORAGE_LATENCY
+  uint32_t start = micros();
+  bool ok = _dispatch(addr, buffer, length, write);
+  _latency(start);
+  return ok;
+#else
+  return _dispatch(addr, buffer, length, write);
+#endif
+}
+
+void SDStorage::_latency(uint32_t start) {
+#if SDSTORAGE_LATENCY
+  uint32_t us = micros() - start;
+  uint8_t bucket = 0;
+  while (us > 1 && bucket < SDSTORAGE_LATENCY_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  _stats.latency[bucket]++;
+#else
+  (void)start;
+#endif
+}
+
+bool SDStorage::_dispatch(uint16_t addr, uint8_t *buffer, uint16_t length, bool write) {
+  if (_profile) _profileAccess(addr, length, write);
+  if (_image) {
+    memcpy(buffer, _image + addr, length);
+    return true;
+  }
+  while (length) {
+    uint16_t n = length;
+    const SDStorageRegion *r = _region(addr, n);
+    SDStoragePolicy policy = r ? r->policy : SDSTORAGE_WRITE_BACK;
+    bool ok;
+    if (policy == SDSTORAGE_VOLATILE) {
+      if (write) {
+        memcpy(_volatile(r, addr), buffer, n);
+      } else {
+        memcpy(buffer, _volatile(r, addr), n);
+      }
+      ok = true;
+    } else if (!write) {
+      if (_pageCount) {
+        ok = _cacheCopy(addr, buffer, n, false);
+        // Read-only streams: prefetch the page following a sequential read.
+        uint32_t end = (uint32_t)addr + n + FILE_HEADER_SIZE;
+        if (ok && _config.readOnly && _pageCount > 1 && (uint32_t)addr + FILE_HEADER_SIZE == _readEnd && end < FILE_HEADER_SIZE + _size) {
+          _page(end);
+        }
+        _readEnd = end;
+      } else {
+        ok = _seek(addr) && _read(buffer, n) == (int)n;
+      }
+    } else if (_pageCount && policy == SDSTORAGE_WRITE_BACK) {
+      ok = _cacheCopy(addr, buffer, n, true, r ? r->maxAge : 0);
+      if (ok) _countUpdate(n);
+    } else {
+      ok = _writeDirect(addr, buffer, n, policy == SDSTORAGE_WRITE_THROUGH);
+    }
+    if (!ok) {
+      if (_status != SDSTORAGE_ERR_ADDRESS) _status = _offline ? SDSTORAGE_ERR_OFFLINE : SDSTORAGE_ERR_IO;
+      return false;
+    }
+    addr += n;
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool SDStorage::_writeDirect(uint16_t addr, const uint8_t *buffer, uint16_t length, bool through) {
+  uint32_t offset = addr + FILE_HEADER_SIZE;
+  // Uncached instances attached to a scheduler leave the threshold flush to it as well.
+  if (!through && (_update + length) >= _tuning.flushThreshold) _flushDue();
+  bool ok = _seek(addr) && _write(buffer, length) == length;
+  if (ok) {
+    if (through) {
+      _update += length;
+      _flushFile();
+    } else {
+      _countUpdate(length);
+    }
+    ok = _verifyDirect(offset, buffer, length);
+  }
+  // Keep resident cache pages coherent without dirtying them. After a failed write the
+  // card may hold part of the new data, so clean pages are dropped and read again.
+  for (uint8_t i = 0; i < _pageCount; i++) {
+    Page *p = &_pages[i];
+    if (!(p->flags & PAGE_VALID) || !_overlaps(p, offset, offset + length)) continue;
+    if (ok) {
+      uint32_t from = (offset > p->base) ? offset : p->base;
+      uint32_t to = (offset + length < p->base + _tuning.pageSize) ? offset + length : p->base + _tuning.pageSize;
+      SEQ_WRITE_BEGIN(p);
+      memcpy(p->data + (from - p->base), buffer + (from - offset), to - from);
+      SEQ_WRITE_END(p);
+    } else if (!(p->flags & (PAGE_DIRTY | PAGE_PINNED))) {
+      SEQ_WRITE_BEGIN(p);
+      p->flags = 0;
+      SEQ_WRITE_END(p);
+    }
+  }
+  return ok;
+}
+
+bool SDStorage::_verifyDirect(uint32_t offset, const uint8_t *buffer, uint16_t length) {
+  if (!_seekOffset(offset)) return false;
+  uint8_t chunk[VERIFY_CHUNK];
+  uint8_t attempt = 0;
+  for (uint16_t i = 0; i < length;) {
+    uint16_t n = length - i;
+    if (n > sizeof(chunk)) n = sizeof(chunk);
+    if (_read(chunk, n, true) != (int)n) return false;
+    if (memcmp(chunk, buffer + i, n) != 0) {
+      // Rewrite only the mismatching chunk, then read it back again.
+      _pos = offset + i;
+      if (!_retry(SDSTORAGE_ERROR_VERIFY, attempt, n) || _write(buffer + i, n) != n) {
+        SDSTORAGE_LOG_IO(F("Verify error: offset=%d, length=%d"), offset + i, n);
+        return false;
+      }
+      _flushFile();
+      if (!_seekOffset(offset + i)) return false;
+      continue;
+    }
+    i += n;
+  }
+  if (attempt) _stats.retried++;
+  return true;
+}
+
+bool SDStorage::_cacheCopy(uint16_t addr, uint8_t *buffer, uint16_t length, bool write, uint32_t maxAge) {
+  uint32_t offset = addr + FILE_HEADER_SIZE;
+  while (length) {
+    uint16_t in = offset & (_tuning.pageSize - 1);
+    uint16_t n = (length < _tuning.pageSize - in) ? length : _tuning.pageSize - in;
+    Page *p = _page(offset, !(write && in == 0 && n == _pageLength(offset)));
+    if (!p) return false;
+    if (write) {
+      SEQ_WRITE_BEGIN(p);
+      memcpy(p->data + in, buffer, n);
+      SEQ_WRITE_END(p);
+      p->flags |= PAGE_DIRTY;
+      if (!_dirtySince) _dirtySince = millis() | 1;
+      if (maxAge) {
+        uint32_t deadline = millis() + maxAge;
+        if (!(p->flags & PAGE_DEADLINE) || (int32_t)(deadline - p->deadline) < 0) p->deadline = deadline;
+        p->flags |= PAGE_DEADLINE;
+      }
+    } else {
+      memcpy(buffer, p->data + in, n);
+    }
+    offset += n;
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+void SDStorage::_countUpdate(uint16_t length) {
+  _update += length;
+  if (_update >= _tuning.flushThreshold) _flushDue();
+}
+
+void SDStorage::_flushDue() {
+  if (_scheduler) {
+    _scheduler->run();
+  } else {
+    flush();
+  }
+}
+
+void SDStorage::_sync() {
+  _flushFile();
+  _update = 0;
+  if (!_nextDirty(0)) _dirtySince = 0;
+}
+
+bool SDStorage::format(uint8_t v) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  uint32_t start = micros();
+  uint32_t done;
+  if (!_resume(OP_FORMAT, v, 0, nullptr, done)) {
+    if (_ee) _ee.close();
+    for (uint8_t i = 0; i < _pageCount; i++) {
+      SEQ_WRITE_BEGIN(&_pages[i]);
+      _pages[i].flags = 0;
+      SEQ_WRITE_END(&_pages[i]);
+    }
+    if (_fileExists(_filename)) {
+      _removeFile(_filename);
+    }
+    _ee = _openFile(_filename, OPEN_CREATE);
+    if (!_ee) {
+      _status = SDSTORAGE_ERR_IO;
+      return false;
+    }
+    uint8_t s[4];
+    memcpy(s, &_size, sizeof(_size));
+    _pos = 0;
+    if (_write(s, sizeof(_size)) != sizeof(_size)) {
+      _status = SDSTORAGE_ERR_IO;
+      return false;
+    }
+  } else if (!_seekOffset(FILE_HEADER_SIZE + done)) {
+    // Other calls between the slices may have moved the file position.
+    _status = SDSTORAGE_ERR_IO;
+    return false;
+  }
+  uint8_t val[SDSTORAGE_CHUNK_SIZE];
+  memset(val, v, sizeof(val));
+  while (done < _size) {
+    uint16_t n = (_size - done < sizeof(val)) ? _size - done : sizeof(val);
+    if (_write(val, n) != n) {
+      _status = SDSTORAGE_ERR_IO;
+      return false;
+    }
+    done += n;
+    if ((done % SECTOR_SIZE == 0 || done == _size) && _pause(OP_FORMAT, v, 0, nullptr, done, _size, start)) return false;
+  }
+  _ee.close();
+  _ee = _openFile(_filename, OPEN_UPDATE);
+  if (!_ee) {
+    _status = SDSTORAGE_ERR_IO;
+    return false;
+  }
+  _saveMeta();
+  _saveWear();
+  _savePartitions();
+  for (uint8_t i = 0; i < SDSTORAGE_MAX_BLOBS; i++) {
+    _saveBlob(i, 0);
+    _saveBlob(i, 1);
+  }
+  _saveSchema();
+  flush();
+  _loadPins();
+  _changed(0, _size);
+  _status = SDSTORAGE_OK;
+  return _initVolatile(v);
+}
+
+bool SDStorage::_resume(uint8_t op, uint16_t addr, uint16_t length, const uint8_t *buffer, uint32_t &done) {
+  bool match = _op.kind == op && _op.addr == addr && _op.length == length && _op.buffer == buffer;
+  done = match ? _op.done : 0;
+  _op.kind = OP_NONE;
+  return match;
+}
+
+bool SDStorage::_pause(uint8_t op, uint16_t addr, uint16_t length, const uint8_t *buffer, uint32_t done, uint32_t total, uint32_t start) {
+  if (_progress) _progress(done, total, _progressContext);
+  if (done >= total || !_timeBudget || micros() - start < _timeBudget) return false;
+  _op.kind = op;
+  _op.addr = addr;
+  _op.length = length;
+  _op.buffer = buffer;
+  _op.done = done;
+  _status = SDSTORAGE_IN_PROGRESS;
+  return true;
+}
+
+bool SDStorage::_busy() {
+  if (_op.kind != OP_FORMAT) return false;
+  _status = SDSTORAGE_IN_PROGRESS;
+  return true;
+}
+
+void SDStorage::setProgress(SDStorageProgress callback, void *context) {
+  _progress = callback;
+  _progressContext = context;
+}
+
+void SDStorage::setTimeBudget(uint32_t us) {
+  _timeBudget = us;
+}
+
+uint32_t SDStorage::getSize() {
+  return _size;
+}
+
+void SDStorage::flush() {
+  if (_config.readOnly || _busy()) return;
+  uint32_t start = micros();
+  _writeBackDirty();
+  if (_wearChanged) _saveWear();
+  _sync();
+  _latency(start);
+}
+
+uint8_t SDStorage::readu8(uint16_t addr) {
+  if (!isValidAddress(addr + FILE_HEADER_SIZE)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return 0;
+  }
+  if (_busy()) return 0;
+  _status = SDSTORAGE_OK;
+  uint8_t val;
+  return _transfer(addr, &val, 1, false) ? val : 0;
+}
+bool SDStorage::writeu8(uint16_t addr, uint8_t val) {
+  return writeArray(addr, &val, 1);
+}
+
+bool SDStorage::updateu8(uint16_t addr, uint8_t val) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (!isValidAddress(addr + FILE_HEADER_SIZE)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  if (readu8(addr) == val) return true;
+  writeu8(addr, val);
+  return (readu8(addr) == val);
+}
+
+uint8_t *SDStorage::readArray(uint16_t addr, uint8_t *buffer, uint16_t length) {
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return nullptr;
+  }
+  if (_busy()) return nullptr;
+  _status = SDSTORAGE_OK;
+  if (!_transfer(addr, buffer, length, false)) {
+    SDSTORAGE_LOG_IO(F("Read error: addr=%d length=%d"), addr, length);
+    return nullptr;
+  }
+  return buffer;
+}
+
+bool SDStorage::writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  if (_busy()) return false;
+  _status = SDSTORAGE_OK;
+  _stats.logicalBytes += length;
+  if (_batch && !_batchOverflow) _undoRecord(addr, length);
+  if (!_transfer(addr, const_cast<uint8_t *>(buffer), length, true)) return false;
+  _changed(addr, length);
+  return true;
+}
+
+bool SDStorage::updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  // Snapshot readers keep seeing the old bytes until the last slice has been applied.
+  if (_undo && !_batch && _op.kind != OP_FORMAT) {
+    beginBatch();
+    _implicitBatch = true;
+  }
+  bool ret = _updateArray(addr, buffer, length);
+  if (_implicitBatch && _status != SDSTORAGE_IN_PROGRESS) commitBatch();
+  return ret;
+}
+
+bool SDStorage::_updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  if (_config.readOnly) {
+    _status = SDSTORAGE_ERR_READ_ONLY;
+    return false;
+  }
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) {
+    _status = SDSTORAGE_ERR_ADDRESS;
+    return false;
+  }
+  if (_busy()) return false;
+
+  uint32_t begin = micros();
+  uint32_t done;
+  _resume(OP_UPDATE, addr, length, buffer, done);
+  uint8_t current[SDSTORAGE_CHUNK_SIZE];
+  while (done < length) {
+    uint16_t chunk = (length - done < sizeof(current)) ? length - done : sizeof(current);
+    uint16_t base = addr + done;
+    const uint8_t *data = buffer + done;
+    if (!readArray(base, current, chunk)) return false;
+
+    uint16_t start = 0;
+    bool in_diff = false;
+    for (uint16_t i = 0; i < chunk; i++) {
+      if (current[i] != data[i]) {
+        if (!in_diff) {
+          start = i;
+          in_diff = true;
+        }
+      } else if (in_diff) {
+        if (!writeArray(base + start, data + start, i - start)) {
+          SDSTORAGE_LOG_IO(F("Write error: addr=%d, length=%d"), base + start, i - start);
+          return false;
+        }
+        in_diff = false;
+      }
+    }
+
+    if (in_diff) {
+      if (!writeArray(base + start, data + start, chunk - start)) {
+        SDSTORAGE_LOG_IO(F("Write error: addr=%d, length=%d"), base + start, chunk - start);
+        return false;
+      }
+    }
+
+    if (!_compare(base, data, chunk)) return false;
+    done += chunk;
+    if (_pause(OP_UPDATE, addr, length, buffer, done, length, begin)) return false;
+  }
+  return true;
+}
+
+bool SDStorage::_compare(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  uint8_t read_buffer[SDSTORAGE_CHUNK_SIZE];
+  while (length) {
+    uint16_t n = (length < sizeof(read_buffer)) ? length : sizeof(read_buffer);
+    if (!readArray(addr, read_buffer, n)) {
+      SDSTORAGE_LOG_IO(F("Read error: addr=%d, length=%d"), addr, n);
+      return false;
+    }
+    if (memcmp(read_buffer, buffer, n) != 0) {
+      return false;
+    }
+    addr += n;
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool SDStorage::verifyArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  if (!isValidAddress(addr + FILE_HEADER_SIZE, length)) return false;
+  if (_busy()) return false;
+  uint32_t start = micros();
+  uint32_t done;
+  _resume(OP_VERIFY, addr, length, buffer, done);
+  while (done < length) {
+    uint16_t n = (length - done < SDSTORAGE_CHUNK_SIZE) ? length - done : SDSTORAGE_CHUNK_SIZE;
+    if (!_compare(addr + done, buffer + done, n)) return false;
+    done += n;
+    if (_pause(OP_VERIFY, addr, length, buffer, done, length, start)) return false;
+  }
 
   return true;
-}
\ No newline at end of file
+};
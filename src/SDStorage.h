@@ -30,6 +30,438 @@
  * @brief Includes StorageBase for the base storage interface.
  */
 
+#ifndef SDSTORAGE_MAX_PAGE_SIZE
+#if defined(__AVR__)
+#define SDSTORAGE_MAX_PAGE_SIZE 512  ///< Largest cache page calibration may choose (AVR: one sector).
+#else
+#define SDSTORAGE_MAX_PAGE_SIZE 4096  ///< Largest cache page calibration may choose.
+#endif
+#endif
+
+#ifndef SDSTORAGE_CHUNK_SIZE
+#if defined(__AVR__)
+#define SDSTORAGE_CHUNK_SIZE 32  ///< Stack buffer and slice size of update, verify and format (AVR).
+#else
+#define SDSTORAGE_CHUNK_SIZE 128  ///< Stack buffer and slice size of update, verify and format.
+#endif
+#endif
+
+#ifndef SDSTORAGE_MAX_PARTITIONS
+#define SDSTORAGE_MAX_PARTITIONS 4  ///< Maximum number of partitions per storage file.
+#endif
+
+#ifndef SDSTORAGE_COROUTINES
+#if !defined(__AVR__) && defined(__cpp_impl_coroutine)
+#define SDSTORAGE_COROUTINES 1  ///< Awaitable API available (C++20 toolchain, not AVR).
+#else
+#define SDSTORAGE_COROUTINES 0  ///< Awaitable API compiled out.
+#endif
+#endif
+
+#if SDSTORAGE_COROUTINES
+#include <coroutine>
+/**
+ * @brief Includes coroutine support for SDStorageAwait.
+ */
+#endif
+
+#ifndef SDSTORAGE_SEQLOCK
+#if defined(ESP32)
+#define SDSTORAGE_SEQLOCK 1  ///< readCached() may run on another core than the writer (per-page seqlock).
+#else
+#define SDSTORAGE_SEQLOCK 0  ///< readCached() runs in the writer's context.
+#endif
+#endif
+
+#ifndef SDSTORAGE_MAX_BLOBS
+#define SDSTORAGE_MAX_BLOBS 4  ///< Maximum number of blobs per storage file.
+#endif
+
+#ifndef SDSTORAGE_SHARED_FILES
+#define SDSTORAGE_SHARED_FILES 2  ///< Number of distinct files read-only instances can share handles for.
+#endif
+
+#ifndef SDSTORAGE_FS
+#if defined(ESP32) || defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
+#define SDSTORAGE_FS 1  ///< begin() accepts any fs::FS (LittleFS, SPIFFS, SD_MMC) instead of the SD library.
+#else
+#define SDSTORAGE_FS 0  ///< Storage files live on the SD library only.
+#endif
+#endif
+
+#ifndef SDSTORAGE_SD_IS_FS
+#if defined(ESP32)
+#define SDSTORAGE_SD_IS_FS 1  ///< The core's SD library is an fs::FS itself and is opened like one (ESP32).
+#else
+#define SDSTORAGE_SD_IS_FS 0  ///< The SD library opens files with SdFat O_* flags.
+#endif
+#endif
+
+#if SDSTORAGE_SD_IS_FS && !SDSTORAGE_FS
+#error "SDSTORAGE_SD_IS_FS needs SDSTORAGE_FS"
+#endif
+
+#if SDSTORAGE_FS
+#include <FS.h>
+/**
+ * @brief Includes the Arduino filesystem interface for the fs::FS backend.
+ */
+#endif
+
+#ifndef SDSTORAGE_LATENCY
+#if defined(__AVR__)
+#define SDSTORAGE_LATENCY 0  ///< Latency histogram of transfers and flushes in SDStorageStats (AVR: off).
+#else
+#define SDSTORAGE_LATENCY 1  ///< Latency histogram of transfers and flushes in SDStorageStats.
+#endif
+#endif
+
+#define SDSTORAGE_LATENCY_BUCKETS 16  ///< Histogram buckets: [2^i, 2^(i+1)) us, the last one open-ended.
+
+#ifndef SDSTORAGE_LOG_LEVEL
+#define SDSTORAGE_LOG_LEVEL 3  ///< 0: silent, 1: setup errors, 2: also I/O errors, 3: also debug messages.
+#endif
+
+#ifndef SDSTORAGE_EVENTS
+#if defined(__AVR__)
+#define SDSTORAGE_EVENTS 4  ///< Entries of the event ring (0 = off, max 255).
+#else
+#define SDSTORAGE_EVENTS 16  ///< Entries of the event ring (0 = off, max 255).
+#endif
+#endif
+
+/**
+ * @brief Logging compiled in or out by SDSTORAGE_LOG_LEVEL; arguments are not evaluated when out.
+ */
+#if SDSTORAGE_LOG_LEVEL >= 1
+#define SDSTORAGE_LOG_ERROR(...) logger.error(__VA_ARGS__)
+#else
+#define SDSTORAGE_LOG_ERROR(...) ((void)0)
+#endif
+#if SDSTORAGE_LOG_LEVEL >= 2
+#define SDSTORAGE_LOG_IO(...) logger.error(__VA_ARGS__)
+#else
+#define SDSTORAGE_LOG_IO(...) ((void)0)
+#endif
+#if SDSTORAGE_LOG_LEVEL >= 3
+#define SDSTORAGE_LOG_DEBUG(...) logger.debug(__VA_ARGS__)
+#else
+#define SDSTORAGE_LOG_DEBUG(...) ((void)0)
+#endif
+
+/**
+ * @brief Result of the last SDStorage operation.
+ */
+enum SDStorageStatus : uint8_t {
+  SDSTORAGE_OK = 0,             ///< Operation succeeded.
+  SDSTORAGE_ERR_READ_ONLY = 1,  ///< Write rejected, the storage is mounted read-only.
+  SDSTORAGE_ERR_ADDRESS = 2,    ///< Address range outside the storage, or past the end of a truncated file.
+  SDSTORAGE_ERR_IO = 3,         ///< SD card read, write, seek or verify failed.
+  SDSTORAGE_IN_PROGRESS = 4,    ///< Time budget used up; call again with the same arguments to resume.
+  SDSTORAGE_ERR_OFFLINE = 5,    ///< Card failed; data not in the cache is unavailable until poll() recovers it.
+};
+
+/**
+ * @brief Class of a failed card transfer, see SDStorageRetry and SDStorageStats::errors.
+ */
+enum SDStorageError : uint8_t {
+  SDSTORAGE_ERROR_SEEK = 0,         ///< File seek failed.
+  SDSTORAGE_ERROR_READ = 1,         ///< Read returned an error.
+  SDSTORAGE_ERROR_SHORT_READ = 2,   ///< Read returned fewer bytes than requested before the end of the file.
+  SDSTORAGE_ERROR_WRITE = 3,        ///< Write accepted no data.
+  SDSTORAGE_ERROR_SHORT_WRITE = 4,  ///< Write accepted only part of the data.
+  SDSTORAGE_ERROR_VERIFY = 5,       ///< Read-back of a write-through range did not match.
+  SDSTORAGE_ERROR_CLASSES = 6,      ///< Number of error classes.
+};
+
+/**
+ * @brief Code of an SDStorageEvent.
+ * @details Transfer errors use the values of SDStorageError.
+ */
+enum SDStorageEventCode : uint8_t {
+  SDSTORAGE_EVENT_SEEK = 0,         ///< File seek failed.
+  SDSTORAGE_EVENT_READ = 1,         ///< Read returned an error.
+  SDSTORAGE_EVENT_SHORT_READ = 2,   ///< Read returned fewer bytes than requested.
+  SDSTORAGE_EVENT_WRITE = 3,        ///< Write accepted no data.
+  SDSTORAGE_EVENT_SHORT_WRITE = 4,  ///< Write accepted only part of the data.
+  SDSTORAGE_EVENT_VERIFY = 5,       ///< Read-back did not match.
+  SDSTORAGE_EVENT_OFFLINE = 6,      ///< Retries exhausted, the card was taken offline.
+  SDSTORAGE_EVENT_RECOVERED = 7,    ///< poll() brought the card back; length holds the outage in seconds.
+};
+
+/**
+ * @brief Compact record of an error or state change, see SDStorage::readEvent().
+ */
+struct SDStorageEvent {
+  uint32_t time;            ///< millis() when it happened.
+  uint32_t offset;          ///< File offset of the failed transfer (address + 4).
+  uint16_t length;          ///< Bytes the failed transfer still had to move.
+  SDStorageEventCode code;  ///< What happened.
+};
+
+/**
+ * @brief Retry policy for failed card transfers.
+ * @details A failed transfer is resumed at the byte where it stopped, so a retry
+ *          only costs the failed sector, not the whole call. The card is marked
+ *          offline once the retries are used up.
+ */
+struct SDStorageRetry {
+  uint8_t attempts = 2;      ///< Retries per failed transfer (0 = fail immediately).
+  uint8_t classes = 0x3F;    ///< Bit mask of retried classes, (1 << SDStorageError).
+  uint16_t backoffUs = 500;  ///< Busy-wait before the first retry, doubled on each further retry.
+};
+
+/**
+ * @brief Progress callback of long operations, invoked between chunks.
+ * @param done Bytes processed so far.
+ * @param total Bytes of the whole operation.
+ * @param context Pointer passed to SDStorage::setProgress().
+ */
+typedef void (*SDStorageProgress)(uint32_t done, uint32_t total, void *context);
+
+struct SDStorageFuture;
+
+/**
+ * @brief Completion callback of SDStorage::readArrayAsync().
+ * @param future Completed read; its status tells whether the buffer is valid.
+ * @param context Pointer passed to readArrayAsync().
+ */
+typedef void (*SDStorageReadCallback)(SDStorageFuture *future, void *context);
+
+/**
+ * @brief Pending or completed asynchronous read, owned by the caller.
+ * @details Must stay alive until ready() or SDStorage::cancelRead(). No memory
+ *          is allocated per request; queued futures are chained through next.
+ */
+struct SDStorageFuture {
+  uint16_t addr = 0;                                ///< First address to read.
+  uint16_t length = 0;                              ///< Number of bytes to read.
+  uint8_t *buffer = nullptr;                        ///< Destination buffer.
+  SDStorageReadCallback callback = nullptr;         ///< Invoked on completion, may be nullptr.
+  void *context = nullptr;                          ///< Passed to callback.
+  volatile SDStorageStatus status = SDSTORAGE_OK;   ///< SDSTORAGE_IN_PROGRESS while queued, then the result.
+  SDStorageFuture *next = nullptr;                  ///< Next queued read, used by SDStorage.
+
+  /**
+   * @brief Tells whether the read has completed.
+   * @return true once status is no longer SDSTORAGE_IN_PROGRESS.
+   */
+  bool ready() const { return status != SDSTORAGE_IN_PROGRESS; }
+};
+
+/**
+ * @brief Work deferred to the next SDStorage::poll(), owned by the caller.
+ */
+struct SDStorageWaiter {
+  void (*callback)(SDStorageWaiter *waiter) = nullptr; ///< Invoked once from poll(); may defer the waiter again.
+  void *context = nullptr;                             ///< Free for the owner.
+  SDStorageWaiter *next = nullptr;                     ///< Next deferred waiter, used by SDStorage.
+};
+
+struct SDStorageWatch;
+
+/**
+ * @brief Change callback of SDStorage::watch().
+ * @param watch Watch whose range changed.
+ * @param addr First changed address inside the watched range.
+ * @param length Number of bytes from addr covering every change since the last call.
+ * @param version Current watch version.
+ * @param context Pointer passed to watch().
+ */
+typedef void (*SDStorageWatchCallback)(SDStorageWatch *watch, uint16_t addr, uint16_t length, uint16_t version,
+                                       void *context);
+
+/**
+ * @brief Subscription to changes of an address range, owned by the caller.
+ * @details Must stay alive until SDStorage::unwatch(). Subscriptions are chained
+ *          through next, no memory is allocated.
+ */
+struct SDStorageWatch {
+  uint16_t addr = 0;                                ///< First watched address.
+  uint16_t length = 0;                              ///< Number of watched bytes.
+  SDStorageWatchCallback callback = nullptr;        ///< Invoked from poll() after changes, may be nullptr.
+  void *context = nullptr;                          ///< Passed to callback.
+  volatile uint16_t version = 0;                    ///< Incremented by every committed write to the range.
+  uint16_t notified = 0;                            ///< Version last passed to callback, used by SDStorage.
+  uint16_t changedAddr = 0;                         ///< Start of the part changed since the last callback, used by SDStorage.
+  uint16_t changedLength = 0;                       ///< Length of that part (0 = none), used by SDStorage.
+  uint16_t batchAddr = 0;                           ///< Start of the part written in the open batch, used by SDStorage.
+  uint16_t batchLength = 0;                         ///< Length of that part (0 = none), used by SDStorage.
+  SDStorageWatch *next = nullptr;                   ///< Next subscription, used by SDStorage.
+};
+
+/**
+ * @brief I/O tuning parameters of an SD card, measured by SDStorage::calibrate().
+ * @details Persisted in the metadata block that follows the data area, so the
+ *          probe only runs once per card. Latencies are in microseconds.
+ */
+struct SDStorageTuning {
+  uint16_t pageSize = 512;         ///< Cache page size and I/O unit in bytes (power of two, >= 512).
+  uint16_t batchPages = 1;         ///< Dirty pages written back in one sequential burst.
+  uint16_t flushThreshold = 512;   ///< Bytes written before an automatic flush.
+  uint16_t reserved = 0;           ///< Padding, keeps the persisted layout identical on all platforms.
+  uint32_t singleWriteUs = 0;      ///< Latency of a single-sector write followed by a flush.
+  uint32_t multiWriteUs = 0;       ///< Per-sector latency of a multi-sector write followed by a flush.
+  uint32_t readUs = 0;             ///< Latency of a single-sector read.
+  uint32_t flushUs = 0;            ///< Cost of a flush after a one-byte write.
+};
+
+/**
+ * @brief Write policy of an address range.
+ */
+enum SDStoragePolicy : uint8_t {
+  SDSTORAGE_WRITE_BACK = 0,     ///< Held in the cache until maxAge expires, the threshold is reached or flush(); buffered until the threshold without cache pages.
+  SDSTORAGE_WRITE_THROUGH = 1,  ///< Written, flushed and verified on the card before the write returns.
+  SDSTORAGE_VOLATILE = 2,       ///< Kept in RAM only, loaded from the card at begin() and never written back.
+};
+
+/**
+ * @brief Address range with its own write policy.
+ */
+struct SDStorageRegion {
+  uint16_t start;          ///< First address of the range.
+  uint16_t length;         ///< Length of the range in bytes.
+  SDStoragePolicy policy;  ///< Write policy of the range.
+  uint32_t maxAge;         ///< SDSTORAGE_WRITE_BACK: maximum age of dirty data in ms before poll() writes it (0 = no limit). Needs cache pages, rejected when cachePages is 0.
+};
+
+/**
+ * @brief Partition of a storage file, see SDStorage::setPartitions() and SDPartition.
+ */
+struct SDStoragePartition {
+  char name[8];            ///< Name, not necessarily null-terminated.
+  SDStorageRegion region;  ///< Length, flush policy and maxAge; start is assigned by setPartitions().
+  uint8_t cachePages;      ///< Maximum cache pages the partition may hold (0 = no limit).
+};
+
+/**
+ * @brief I/O counters of an SDStorage instance.
+ * @details Physical cost is estimated in 512-byte sectors: the FAT layer programs
+ *          whole sectors, so a write touching part of a sector (for example due
+ *          to the 4-byte header offset) costs the full sector, and every flush
+ *          that changed the file rewrites its directory entry sector.
+ */
+struct SDStorageStats {
+  uint32_t logicalBytes = 0;   ///< Bytes passed to the write methods.
+  uint32_t issuedBytes = 0;    ///< Bytes passed to the SD library for writing.
+  uint32_t sectorWrites = 0;   ///< 512-byte sectors touched by writes.
+  uint32_t readBytes = 0;      ///< Bytes read from the card, verification excluded.
+  uint32_t verifyBytes = 0;    ///< Bytes read back from the card for verification.
+  uint32_t flushes = 0;        ///< Card flushes (directory entry updates).
+  uint32_t seeks = 0;          ///< File seeks.
+  uint16_t outages = 0;        ///< Card failures detected.
+  uint16_t recoveries = 0;     ///< Successful recoveries by poll().
+  uint32_t lastRecoveryMs = 0; ///< Duration of the last outage in ms.
+  uint32_t downtimeMs = 0;     ///< Total duration of recovered outages in ms.
+  uint32_t retries = 0;        ///< Transfers retried.
+  uint32_t retried = 0;        ///< Transfers that succeeded after one or more retries.
+  uint16_t errors[SDSTORAGE_ERROR_CLASSES] = {}; ///< Failed transfers per SDStorageError class, retried or not.
+  uint32_t migrationMs = 0;    ///< Duration of the last migrate() in ms.
+  uint16_t eventsLost = 0;     ///< Events overwritten before readEvent() drained them.
+#if SDSTORAGE_LATENCY
+  uint32_t latency[SDSTORAGE_LATENCY_BUCKETS] = {}; ///< Transfers and flushes by duration, bucket i: [2^i, 2^(i+1)) us.
+#endif
+};
+
+/**
+ * @brief RAM used by one SDStorage configuration, see SDStorage::footprint().
+ * @details Excludes the SD library (its 512-byte sector buffer and card state) and
+ *          allocator overhead, which are the same for every configuration.
+ */
+struct SDStorageFootprint {
+  uint32_t staticBytes; ///< The instance itself, File object and name included, plus the shared handle table.
+  uint32_t stackBytes;  ///< Local buffers of the deepest call chain, frames excluded.
+  uint32_t heapBytes;   ///< Cache pages, image, snapshot log, volatile regions, wear and profile tables.
+};
+
+#if SDSTORAGE_FS
+/**
+ * @brief Remounts the filesystem of an fs::FS instance before poll() reopens its file.
+ * @param fs Filesystem passed to begin().
+ * @param context SDStorageConfig::remountContext.
+ * @return true if the filesystem is usable again.
+ */
+typedef bool (*SDStorageRemount)(fs::FS &fs, void *context);
+#endif
+
+/**
+ * @brief Optional settings for SDStorage::begin().
+ */
+struct SDStorageConfig {
+  bool calibrate = false;                   ///< Probe the card at mount if no tuning has been persisted yet.
+  uint8_t cachePages = 0;                   ///< Number of write-back cache pages (0 = uncached, write-through).
+  const SDStorageRegion *regions = nullptr; ///< Non-overlapping address ranges with their own policy (must outlive the storage).
+  uint8_t regionCount = 0;                  ///< Number of entries in regions.
+  bool readOnly = false;                    ///< Open read-only, reject writes and share the file handle with other readers.
+  bool cacheImage = false;                  ///< readOnly: load the whole image into RAM once, shared by all readers of the file.
+  bool trackWear = false;                   ///< Keep per-sector write counters, persisted in the metadata block on flush().
+  uint16_t profileLine = 0;                 ///< Record read/write counts per line of this many bytes (power of two, 0 = off).
+  const uint16_t *pins = nullptr;           ///< Addresses whose cache pages are preloaded and never evicted (must outlive the storage).
+  uint8_t pinCount = 0;                     ///< Number of entries in pins, at most cachePages - 1 take effect.
+  SDStorageRetry retry;                     ///< Retry policy for failed card transfers.
+  uint16_t snapshotBytes = 0;               ///< RAM for the old bytes of writes in an open batch, see readSnapshot() (0 = off).
+#if SDSTORAGE_FS
+  SDStorageRemount remount = nullptr;       ///< fs::FS instances: remounts the filesystem during recovery (nullptr = reopen the file only).
+  void *remountContext = nullptr;           ///< Passed to remount.
+#endif
+};
+
+class SDScheduler;
+class SDStorage;
+class SDStorageMigrationSource;
+
+/**
+ * @brief Builds part of the new image in a migration step.
+ * @param source Image of the previous schema version.
+ * @param addr First address to build, inside the step's range.
+ * @param out Receives the new bytes.
+ * @param length Number of bytes to build.
+ * @param context Pointer from SDStorageMigration.
+ * @return true if successful, false to abort the migration.
+ */
+typedef bool (*SDStorageMigrate)(SDStorageMigrationSource &source, uint16_t addr, uint8_t *out, uint16_t length, void *context);
+
+/**
+ * @brief Migration step from schema version - 1 to version, see SDStorage::migrate().
+ */
+struct SDStorageMigration {
+  uint16_t version;       ///< Schema version the step produces.
+  uint16_t start;         ///< First address the step changes.
+  uint16_t length;        ///< Bytes the step changes; the rest keeps its previous content.
+  SDStorageMigrate build; ///< Builds the changed bytes from the previous version.
+  void *context;          ///< Passed to build.
+};
+
+/**
+ * @brief Read access to the image of the previous schema version during a migration.
+ * @details Reads of earlier steps' ranges are built on the fly, so a chain of
+ *          steps needs no intermediate images.
+ */
+class SDStorageMigrationSource {
+  friend class SDStorage;
+
+ private:
+  SDStorage *_storage;               ///< Storage being migrated.
+  const SDStorageMigration *_steps;  ///< Pending steps.
+  uint8_t _level;                    ///< Number of steps applied to this view.
+
+ public:
+  /**
+   * @brief Reads bytes of the previous version.
+   * @param addr Starting address.
+   * @param buffer Buffer to store data.
+   * @param length Number of bytes to read.
+   * @return true if successful, false otherwise.
+   */
+  bool read(uint16_t addr, uint8_t *buffer, uint16_t length);
+};
+
+class SDPartition;
+class SDBlob;
+class SDStorageAwait;
+template <class T>
+class PersistentArray;
+
 /**
  * @brief SDStorage class for emulating EEPROM-like storage on an SD card.
  * @details Inherits from StorageBase, provides synchronous read/write operations
@@ -37,24 +469,699 @@
  *          automation systems. Supports verification and efficient updates.
  */
 class SDStorage : public StorageBase {
+  friend class SDScheduler;
+  friend class SDPartition;
+  friend class SDBlob;
+  friend class SDStorageMigrationSource;
+  friend class SDStorageAwait;
+  template <class T>
+  friend class PersistentArray;
+
  private:
   /**
-   * @brief Seeks to the specified address in the file, accounting for the header.
-   * @param addr Address to seek (0 to size-1).
-   * @return true if seek successful, false otherwise.
+   * @brief Read-modify-write operation of _modify().
+   */
+  enum ModifyOp : uint8_t { MODIFY_CAS, MODIFY_ADD, MODIFY_OR, MODIFY_AND };
+
+  /**
+   * @brief File handle shared by read-only instances.
+   */
+  struct SharedFile {
+    char name[13];      ///< Filename, empty if the slot is free.
+    File file;          ///< Shared handle.
+    uint8_t refs;       ///< Number of instances using the handle.
+    uint8_t *image;     ///< Whole-image copy, if loaded.
+    uint8_t generation; ///< Incremented when the handle is reopened after a card failure.
+#if SDSTORAGE_FS
+    fs::FS *fs;         ///< Filesystem of the file, nullptr for the SD library.
+#endif
+  };
+
+  static SharedFile _shared[SDSTORAGE_SHARED_FILES]; ///< Handles shared by read-only instances.
+  static uint8_t _cardGeneration;                    ///< Incremented whenever an instance restarts the card.
+
+  // Stack buffers besides the SDSTORAGE_CHUNK_SIZE ones, counted by footprint().
+  static const uint8_t VERIFY_CHUNK = 32;    ///< Read-back buffer of _verifyDirect().
+  static const uint8_t JOURNAL_HEADER = 12;  ///< Migration journal header of migrate() and _replayJournal().
+  static const uint16_t PROBE_SECTOR = 512;  ///< Probe buffer of calibrate().
+
+  // Modes of _openFile(), mapped to the O_* flags or the mode string of the backend.
+  static const uint8_t OPEN_READ = 0;    ///< Read only.
+  static const uint8_t OPEN_UPDATE = 1;  ///< Read and write an existing file.
+  static const uint8_t OPEN_CREATE = 2;  ///< Create, or truncate, for writing.
+
+  /**
+   * @brief Larger of two values, usable in footprint().
+   */
+  static constexpr uint32_t _max(uint32_t a, uint32_t b) {
+    return (a > b) ? a : b;
+  }
+
+  /**
+   * @brief Returns the file offset of the partition table.
+   * @return File offset.
+   */
+  uint32_t _partitionOffset();
+
+  /**
+   * @brief Reads the partition table from the metadata area.
+   * @return true if a table was found, false otherwise.
+   */
+  bool _loadPartitions();
+
+  /**
+   * @brief Writes the partition table to the metadata area.
+   * @return true if successful, false otherwise.
+   */
+  bool _savePartitions();
+
+  /**
+   * @brief Reads the blob directory from the metadata area.
+   */
+  void _loadBlobs();
+
+  /**
+   * @brief Writes one copy of a blob directory entry.
+   * @param slot Blob slot.
+   * @param copy Copy to write (0 or 1).
+   * @return true if successful, false otherwise.
+   */
+  bool _saveBlob(uint8_t slot, uint8_t copy);
+
+  /**
+   * @brief Computes the check word of a blob directory entry or journal header.
+   * @param data Serialized record without its check word.
+   * @param length Length of data.
+   * @return Check word.
+   */
+  static uint16_t _checkWord(const uint8_t *data, uint8_t length);
+
+  /**
+   * @brief Atomically replaces a blob directory entry.
+   * @param name Blob name.
+   * @param size Size in bytes.
+   * @param generation Generation of the data file.
+   * @param used false to remove the blob.
+   * @return true if successful, false if the directory is full or the write failed.
+   */
+  bool _commitBlob(const char *name, uint32_t size, uint8_t generation, bool used);
+
+  /**
+   * @brief Extends the file with zeros, seeks cannot go past its end.
+   * @param end File size to reach.
+   * @return true if successful, false otherwise.
+   */
+  bool _extendTo(uint32_t end);
+
+  /**
+   * @brief Reads the schema version from the metadata area.
+   */
+  void _loadSchema();
+
+  /**
+   * @brief Writes the schema version to the metadata area.
+   * @return true if successful, false otherwise.
+   */
+  bool _saveSchema();
+
+  /**
+   * @brief Returns the file offset of the migration journal.
+   * @return File offset.
+   */
+  uint32_t _journalOffset();
+
+  /**
+   * @brief Completes a committed migration: copies the journal into the data area,
+   *        stores the new schema version and clears the journal.
+   * @return true if a journal was replayed, false if none was pending or the copy failed.
+   */
+  bool _replayJournal();
+
+  /**
+   * @brief Tells whether the journal holds a committed migration not yet replayed.
+   * @return true if its header carries the journal magic.
+   */
+  bool _journalPending();
+
+  /**
+   * @brief Looks up a committed blob by name.
+   * @param name Blob name.
+   * @return Slot index, or -1 if not found.
+   */
+  int8_t _findBlob(const char *name);
+
+  /**
+   * @brief Looks up a partition by name.
+   * @param name Partition name.
+   * @return Index into the partition table, or -1 if not found.
+   */
+  int8_t _findPartition(const char *name);
+
+  /**
+   * @brief Saves the current bytes of a range about to be written in an open batch.
+   * @param addr Starting address.
+   * @param length Number of bytes.
+   */
+  void _undoRecord(uint16_t addr, uint16_t length);
+
+  /**
+   * @brief Overlays the old bytes of the batch log, so a range reads as of beginBatch().
+   * @param addr Starting address of the range.
+   * @param buffer Current data of the range, updated.
+   * @param length Length of the range.
+   * @param used Bytes of the log to apply.
+   */
+  void _overlayUndo(uint16_t addr, uint8_t *buffer, uint16_t length, uint16_t used);
+
+  /**
+   * @brief Implements updateArray(), without the implicit batch.
+   * @param addr Starting address.
+   * @param buffer Data to write.
+   * @param length Number of bytes to update.
+   * @return true if successful, false otherwise.
+   */
+  bool _updateArray(uint16_t addr, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Atomically reads, modifies and writes an 8, 16 or 32-bit little-endian value.
+   * @details One read (served by the cache page when cached) and one write; in
+   *          write-back ranges the write only dirties the page, no verify read follows.
+   *          Unchanged values are not written.
+   * @param addr Address of the value.
+   * @param size Size of the value in bytes (1, 2 or 4).
+   * @param op Operation.
+   * @param operand New value (MODIFY_CAS), addend or mask.
+   * @param compare Expected value (MODIFY_CAS only).
+   * @param old Value before the operation.
+   * @return true if successful, false on error or a failed compare (status SDSTORAGE_OK).
+   */
+  bool _modify(uint16_t addr, uint8_t size, ModifyOp op, uint32_t operand, uint32_t compare, uint32_t &old);
+
+  /**
+   * @brief Copies part of a resident page for readCached().
+   * @param base File offset of the page.
+   * @param in Offset inside the page.
+   * @param buffer Destination.
+   * @param length Number of bytes, within the page.
+   * @return true if the page is resident and a consistent copy was made.
+   */
+  bool _copyPage(uint32_t base, uint16_t in, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Tells whether a range can be read without card access.
+   * @param addr Starting address.
+   * @param length Number of bytes.
+   * @return true if every byte is in a volatile region, a resident cache page or the image.
+   */
+  bool _resident(uint16_t addr, uint16_t length);
+
+  /**
+   * @brief Completes queued asynchronous reads, merging those that share sectors.
+   */
+  void _serviceReads();
+
+  /**
+   * @brief Sets the result of an asynchronous read and invokes its callback.
+   * @param future Read to complete (already removed from the queue).
+   * @param status Result.
+   */
+  void _completeRead(SDStorageFuture *future, SDStorageStatus status);
+
+  /**
+   * @brief Extends a range to cover [from, to).
+   * @param addr Start of the range, updated.
+   * @param length Length of the range (0 = empty), updated.
+   */
+  static void _cover(uint16_t &addr, uint16_t &length, uint32_t from, uint32_t to);
+
+  /**
+   * @brief Counts a committed write against the overlapping watches.
+   * @details Inside a write batch the change is held back until commitBatch().
+   * @param addr Starting address.
+   * @param length Number of bytes written.
+   */
+  void _changed(uint16_t addr, uint32_t length);
+
+  /**
+   * @brief Counts a failed transfer and prepares its retry at the current file position.
+   * @param error Class of the failure.
+   * @param attempt Retries made so far for this transfer, incremented.
+   * @param length Bytes not transferred yet, recorded in the event ring.
+   * @return true if the transfer should be retried, false if the policy gives up.
+   */
+  bool _retry(SDStorageError error, uint8_t &attempt, uint16_t length);
+
+  /**
+   * @brief Appends a record to the event ring, overwriting the oldest when full.
+   * @param code What happened.
+   * @param offset File offset concerned.
+   * @param length Bytes concerned.
+   */
+  void _event(SDStorageEventCode code, uint32_t offset, uint16_t length);
+
+  /**
+   * @brief Marks the card offline after an I/O failure and schedules recovery.
+   */
+  void _fail();
+
+  /**
+   * @brief Restarts the card and reopens the file once the backoff has elapsed, then replays dirty pages.
+   * @return true if the storage is online again, false otherwise.
+   */
+  bool _recover();
+
+  /**
+   * @brief Restarts the backend before the file is reopened.
+   * @details SD library: re-runs SD.begin(), unless another instance already did since this
+   *          one went offline. fs::FS: calls SDStorageConfig::remount if set.
+   * @return true if successful, false otherwise.
+   */
+  bool _restartCard();
+
+  /**
+   * @brief Opens a file on the storage's filesystem.
+   * @param path Path of the file.
+   * @param mode OPEN_READ, OPEN_UPDATE or OPEN_CREATE.
+   * @return File handle, false if it cannot be opened.
+   */
+  File _openFile(const char *path, uint8_t mode);
+
+  /**
+   * @brief Tells whether a file or directory exists on the storage's filesystem.
+   * @param path Path to check.
+   * @return true if it exists.
+   */
+  bool _fileExists(const char *path);
+
+  /**
+   * @brief Removes a file from the storage's filesystem.
+   * @param path Path of the file.
+   * @return true if removed.
+   */
+  bool _removeFile(const char *path);
+
+  /**
+   * @brief Creates a directory on the storage's filesystem.
+   * @param path Path of the directory.
+   * @return true if created.
+   */
+  bool _makeDir(const char *path);
+
+  /**
+   * @brief Opens the storage file and allocates the configured tables once the filesystem is mounted.
+   * @param size Size of the emulated storage in bytes.
+   * @param filename Name of the file.
+   * @return true if successful, false otherwise.
+   */
+  bool _mount(size_t size, const char *filename);
+
+  /**
+   * @brief Opens the file read-only, reusing the handle of another reader if possible.
+   * @return true if successful, false otherwise.
+   */
+  bool _openShared();
+
+  /**
+   * @brief Releases the shared handle, closing it with its last reader.
+   */
+  void _closeShared();
+
+  /**
+   * @brief Seeks to the specified address in the file, accounting for the header.
+   * @param addr Address to seek (0 to size-1).
+   * @return true if seek successful, false otherwise.
+   */
+  bool _seek(uint32_t addr);
+
+  /**
+   * @brief Seeks to a raw file offset (header included).
+   * @param offset File offset.
+   * @return true if seek successful, false otherwise.
+   */
+  bool _seekOffset(uint32_t offset);
+
+  /**
+   * @brief Directory entry of a committed blob, see SDBlob.
+   */
+  struct BlobEntry {
+    char name[8];       ///< Blob name, not necessarily null-terminated.
+    uint32_t size;      ///< Size in bytes.
+    uint8_t generation; ///< Incremented on each commit, selects the data file.
+    uint8_t used;       ///< 1 if the slot holds a blob.
+    uint8_t copy;       ///< Which of the two on-card copies is current.
+  };
+
+  /**
+   * @brief Cache page descriptor.
+   */
+  struct Page {
+    uint32_t base;     ///< File offset of the first byte held by the page (page-aligned).
+    uint32_t stamp;    ///< Last use, for LRU eviction.
+    uint32_t deadline; ///< millis() by which poll() writes the page back (with PAGE_DEADLINE).
+    uint8_t flags;     ///< PAGE_VALID / PAGE_DIRTY / PAGE_DEADLINE bits.
+    uint8_t *data;     ///< Page contents (tuning.pageSize bytes).
+#if SDSTORAGE_SEQLOCK
+    uint32_t seq;      ///< Seqlock sequence, odd while the page is being changed.
+#endif
+  };
+
+  /**
+   * @brief Returns the number of valid bytes in the page starting at file offset base.
+   * @param base Page-aligned file offset.
+   * @return Page length, shorter than the page size for the last page.
+   */
+  uint16_t _pageLength(uint32_t base);
+
+  /**
+   * @brief Returns true if the page covers any byte of the file range [from, to).
+   */
+  bool _overlaps(const Page *page, uint32_t from, uint32_t to);
+
+  /**
+   * @brief Returns the page to evict: an unused page, else the least recently used one.
+   * @param from Start of the file range the page must overlap.
+   * @param to End of the range, or 0 to consider every page. Unused pages belong to no range.
+   * @return Page pointer, or nullptr if every candidate is pinned.
+   */
+  Page *_victim(uint32_t from, uint32_t to);
+
+  /**
+   * @brief Returns the cache page holding the file offset, loading or evicting as needed.
+   * @param offset File offset.
+   * @param load false if the caller overwrites the whole page and no card read is needed.
+   * @return Page pointer, or nullptr on I/O error or if no page can be evicted.
+   */
+  Page *_page(uint32_t offset, bool load = true);
+
+  /**
+   * @brief Writes a dirty page back to the card and verifies it.
+   * @param page Page to write.
+   * @return true if successful, false otherwise.
+   */
+  bool _writeBack(Page *page);
+
+  /**
+   * @brief Returns the dirty page with the lowest file offset at or above from.
+   * @param from Lowest file offset to consider.
+   * @return Page pointer, or nullptr if there is none.
+   */
+  Page *_nextDirty(uint32_t from);
+
+  /**
+   * @brief Writes back up to max dirty pages in ascending address order.
+   * @param max Maximum number of pages (0 = all).
+   * @param from Lowest file offset to start the sweep at.
+   * @return true if successful, false otherwise.
+   */
+  bool _writeBackDirty(uint16_t max = 0, uint32_t from = 0);
+
+  /**
+   * @brief Allocates the page cache after the tuning is known.
+   * @return true if successful or caching is disabled, false if out of memory.
+   */
+  bool _allocCache();
+
+  /**
+   * @brief Writes back and frees the page cache.
+   */
+  void _releaseCache();
+
+  /**
+   * @brief Copies bytes between the caller and the cache.
+   * @param addr Starting address.
+   * @param buffer Data buffer.
+   * @param length Number of bytes.
+   * @param write true to copy into the cache and mark the pages dirty.
+   * @param maxAge Write-back deadline in ms for newly dirtied data (0 = none).
+   * @return true if successful, false otherwise.
+   */
+  bool _cacheCopy(uint16_t addr, uint8_t *buffer, uint16_t length, bool write, uint32_t maxAge = 0);
+
+  /**
+   * @brief Returns the region containing addr and clips length to the segment with a single policy.
+   * @param addr Starting address.
+   * @param length Segment length, clipped in place.
+   * @return Region, or nullptr for the default policy.
+   */
+  const SDStorageRegion *_region(uint16_t addr, uint16_t &length);
+
+  /**
+   * @brief Returns the RAM copy of an address inside a volatile region.
+   * @param region Volatile region.
+   * @param addr Address inside the region.
+   * @return Pointer into the volatile RAM block.
+   */
+  uint8_t *_volatile(const SDStorageRegion *region, uint16_t addr);
+
+  /**
+   * @brief State of a sliced operation that ran out of time budget.
+   */
+  struct Resume {
+    uint8_t kind;          ///< OP_* of the interrupted operation, OP_NONE if none.
+    uint16_t addr;         ///< Address argument (format: fill value).
+    uint16_t length;       ///< Length argument.
+    const uint8_t *buffer; ///< Buffer argument.
+    uint32_t done;         ///< Bytes completed.
+  };
+
+  /**
+   * @brief Picks up an interrupted operation if the arguments match, otherwise drops it.
+   * @param op OP_* of the calling operation.
+   * @param addr Address argument.
+   * @param length Length argument.
+   * @param buffer Buffer argument.
+   * @param done Set to the bytes already completed, 0 when starting over.
+   * @return true if the operation resumes, false if it starts from the beginning.
+   */
+  bool _resume(uint8_t op, uint16_t addr, uint16_t length, const uint8_t *buffer, uint32_t &done);
+
+  /**
+   * @brief Reports progress and suspends the operation once the time budget is used up.
+   * @param op OP_* of the calling operation.
+   * @param addr Address argument.
+   * @param length Length argument.
+   * @param buffer Buffer argument.
+   * @param done Bytes completed.
+   * @param total Bytes of the whole operation.
+   * @param start micros() at the start of the call.
+   * @return true if the operation must return SDSTORAGE_IN_PROGRESS now.
+   */
+  bool _pause(uint8_t op, uint16_t addr, uint16_t length, const uint8_t *buffer, uint32_t done, uint32_t total, uint32_t start);
+
+  /**
+   * @brief Rejects accesses while a sliced format is pending.
+   * @return true (and status SDSTORAGE_IN_PROGRESS) if the file is being formatted.
+   */
+  bool _busy();
+
+  /**
+   * @brief Compares stored data with a buffer, chunk by chunk.
+   * @param addr Starting address.
+   * @param buffer Data to compare with.
+   * @param length Number of bytes.
+   * @return true if equal, false on mismatch or read error.
+   */
+  bool _compare(uint16_t addr, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Preloads and pins the pages of the configured pin list.
+   * @details Drops the previous pins first; one page always stays evictable.
+   */
+  void _loadPins();
+
+  /**
+   * @brief Adds an access to the profile counters of the lines it touches.
+   * @param addr Starting address.
+   * @param length Number of bytes.
+   * @param write true for a write access.
    */
-  bool _seek(uint32_t addr);
+  void _profileAccess(uint16_t addr, uint16_t length, bool write);
+
+  /**
+   * @brief Reads or writes a range, counting its duration in the latency histogram.
+   * @param addr Starting address.
+   * @param buffer Data buffer.
+   * @param length Number of bytes.
+   * @param write true to write.
+   * @return true if successful, false otherwise.
+   */
+  bool _transfer(uint16_t addr, uint8_t *buffer, uint16_t length, bool write);
+
+  /**
+   * @brief Reads or writes a range, dispatching each segment by its region policy.
+   * @param addr Starting address.
+   * @param buffer Data buffer.
+   * @param length Number of bytes.
+   * @param write true to write.
+   * @return true if successful, false otherwise.
+   */
+  bool _dispatch(uint16_t addr, uint8_t *buffer, uint16_t length, bool write);
+
+  /**
+   * @brief Counts an operation in the latency histogram.
+   * @param start micros() when the operation started.
+   */
+  void _latency(uint32_t start);
+
+  /**
+   * @brief Writes a segment directly to the card and verifies it there.
+   * @param addr Starting address.
+   * @param buffer Data to write.
+   * @param length Number of bytes.
+   * @param through true to flush immediately (write-through), false to flush at the threshold.
+   * @return true if successful, false otherwise.
+   */
+  bool _writeDirect(uint16_t addr, const uint8_t *buffer, uint16_t length, bool through);
+
+  /**
+   * @brief Compares a range on the card (bypassing the cache) with a buffer.
+   * @param offset File offset.
+   * @param buffer Expected data.
+   * @param length Number of bytes.
+   * @return true if equal, false on mismatch or read error.
+   */
+  bool _verifyDirect(uint32_t offset, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Loads the volatile regions from the card, or fills them with a value.
+   * @param fill Fill value, or -1 to load from the card.
+   * @return true if successful, false otherwise.
+   */
+  bool _initVolatile(int16_t fill);
+
+  /**
+   * @brief Counts written bytes and flushes once the flush threshold is reached.
+   * @param length Bytes just written.
+   */
+  void _countUpdate(uint16_t length);
+
+  /**
+   * @brief Flushes for the flush threshold: through the scheduler if attached, else flush().
+   */
+  void _flushDue();
+
+  /**
+   * @brief Flushes the file and resets the flush bookkeeping without writing back pages.
+   */
+  void _sync();
+
+  /**
+   * @brief Reads from the current file position and updates the counters.
+   * @param buffer Destination.
+   * @param length Number of bytes.
+   * @param verify true if the read verifies a write.
+   * @return Number of bytes read, or -1 on error.
+   */
+  int _read(uint8_t *buffer, uint16_t length, bool verify = false);
+
+  /**
+   * @brief Writes at the current file position and updates the counters and wear table.
+   * @param buffer Data to write.
+   * @param length Number of bytes.
+   * @return Number of bytes written.
+   */
+  size_t _write(const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Flushes the file and counts the flush.
+   */
+  void _flushFile();
+
+  /**
+   * @brief Returns the size of the metadata area, wear table included.
+   * @return Size in bytes.
+   */
+  uint32_t _metaSize();
+
+  /**
+   * @brief Reads the persisted wear table into RAM.
+   * @return true if a matching table was found, false otherwise.
+   */
+  bool _loadWear();
+
+  /**
+   * @brief Persists the wear table.
+   * @return true if successful or wear tracking is disabled, false otherwise.
+   */
+  bool _saveWear();
+
+  /**
+   * @brief Reads the metadata block (tuning) that follows the data area.
+   * @return true if a valid block was found, false otherwise.
+   */
+  bool _loadMeta();
+
+  /**
+   * @brief Writes the metadata block that follows the data area.
+   * @return true if successful, false otherwise.
+   */
+  bool _saveMeta();
 
  protected:
-  uint32_t _size;        ///< Size of the emulated storage in bytes.
-  char _filename[13];    ///< Filename for the SD storage file (max 8.3 format, 12 chars + null).
-  File _ee;              ///< File object for SD card operations.
-  uint32_t _update = 0;  ///< Counter for bytes written since last flush.
+  uint32_t _size;                         ///< Size of the emulated storage in bytes.
+#if SDSTORAGE_FS
+  fs::FS *_fs = nullptr;                  ///< Filesystem of the file, nullptr for the SD library.
+#endif
+  char _filename[13];                     ///< Filename for the SD storage file (max 8.3 format, 12 chars + null).
+  File _ee;                               ///< File object for SD card operations.
+  uint32_t _update = 0;                   ///< Counter for bytes written since last flush.
+  SDStorageConfig _config;                ///< Settings passed to begin().
+  SDStorageTuning _tuning;                ///< Active I/O tuning.
+  Page *_pages = nullptr;                 ///< Cache page descriptors.
+  uint8_t _pageCount = 0;                 ///< Number of allocated cache pages.
+  uint32_t _clock = 0;                    ///< LRU clock.
+  uint32_t _dirtySince = 0;               ///< millis() when the oldest unwritten page was dirtied (0 = clean).
+  SDScheduler *_scheduler = nullptr;      ///< Shared write-back scheduler, if attached.
+  uint8_t *_volatileRam = nullptr;        ///< RAM backing of the SDSTORAGE_VOLATILE regions.
+  SharedFile *_sharedFile = nullptr;      ///< Shared handle slot when mounted read-only.
+  const uint8_t *_image = nullptr;        ///< Whole-image copy when mounted read-only with cacheImage.
+  uint32_t _readEnd = 0;                  ///< File offset following the last read, for read-ahead detection.
+  uint32_t _pos = 0;                      ///< Current file position, for sector accounting.
+  SDStorageStats _stats;                  ///< I/O counters.
+  uint16_t *_wear = nullptr;              ///< Per-sector write counters (count = value << _wearShift).
+  uint16_t _wearSectors = 0;              ///< Number of sectors covered by the wear table.
+  uint16_t _wearShift = 0;                ///< Scale of the wear counters, incremented when one saturates.
+  bool _wearChanged = false;              ///< Wear table changed since it was last persisted.
+  uint16_t *_profile = nullptr;           ///< Profile counters, reads and writes interleaved per line.
+  uint16_t _profileLines = 0;             ///< Number of profiled lines.
+  Resume _op = {};                        ///< Interrupted sliced operation.
+  SDStorageProgress _progress = nullptr;  ///< Progress callback of long operations.
+  void *_progressContext = nullptr;       ///< Context passed to the progress callback.
+  uint32_t _timeBudget = 0;               ///< Time budget of long operations in microseconds (0 = unlimited).
+  int _pin = 4;                           ///< Chip select pin, for recovery.
+  bool _offline = false;                  ///< Card failed and has not been recovered yet.
+  uint32_t _offlineSince = 0;             ///< millis() when the card failed.
+  uint32_t _retryAt = 0;                  ///< millis() of the next recovery attempt.
+  uint32_t _backoff = 0;                  ///< Current recovery backoff in ms.
+  uint8_t _cardSeen = 0;                  ///< _cardGeneration this instance last synchronized with.
+  uint8_t _sharedGeneration = 0;          ///< Generation of the shared handle in _ee.
+  SDStoragePartition _partitions[SDSTORAGE_MAX_PARTITIONS]; ///< Partition table.
+  uint8_t _partitionCount = 0;            ///< Number of partitions.
+  BlobEntry _blobs[SDSTORAGE_MAX_BLOBS] = {}; ///< Blob directory.
+  uint16_t _schema = 0;                   ///< Schema version of the data, see migrate().
+  const SDStoragePartition *_active = nullptr; ///< Partition an access is made through, for its cache quota.
+  SDStorageFuture *_reads = nullptr;      ///< Queued asynchronous reads, sorted by address.
+  SDStorageWaiter *_waiters = nullptr;    ///< Work deferred to the next poll().
+  SDStorageWatch *_watches = nullptr;     ///< Change subscriptions.
+#if SDSTORAGE_EVENTS
+  SDStorageEvent _events[SDSTORAGE_EVENTS]; ///< Event ring.
+  uint8_t _eventHead = 0;                 ///< Slot of the next event.
+  uint8_t _eventCount = 0;                ///< Events not drained yet.
+#endif
+  uint8_t *_undo = nullptr;               ///< Old bytes of writes in the open batch.
+  uint16_t _undoUsed = 0;                 ///< Bytes used in _undo.
+  bool _batch = false;                    ///< A write batch is open.
+  bool _implicitBatch = false;            ///< The open batch belongs to a time-sliced updateArray().
+  bool _batchOverflow = false;            ///< The open batch outgrew _undo, snapshots unavailable until commit.
+#if SDSTORAGE_SEQLOCK
+  uint32_t _batchSeq = 0;                 ///< Batch sequence for readSnapshotCached(), odd while a batch is open.
+#endif
+  SDStorageStatus _status = SDSTORAGE_OK; ///< Result of the last operation.
 
   /**
    * @brief Opens the SD file with the specified size and filename.
    * @param size Size of the emulated storage.
-   * @param filename Name of the SD file (8.3 format, max 12 characters).
+   * @param filename Name of the SD file (8.3 format, max 12 characters, ESP32 needs a leading '/').
    * @return true if opened successfully, false otherwise.
    */
   bool open(uint32_t size, const char *filename);
@@ -69,7 +1176,7 @@ class SDStorage : public StorageBase {
    * @param addr Starting address (0 to size-1).
    * @param buffer Buffer to store data.
    * @param length Number of bytes to read.
-   * @return Pointer to the buffer, or nullptr if address invalid.
+   * @return Pointer to the buffer, or nullptr if the address is invalid or the read failed after retries.
    */
   uint8_t *readArray(uint16_t addr, uint8_t *buffer, uint16_t length) override;
 
@@ -105,12 +1212,491 @@ class SDStorage : public StorageBase {
   /**
    * @brief Initializes the SD card and opens the storage file.
    * @param size Size of the emulated storage in bytes.
-   * @param filename Name of the SD file (8.3 format, max 12 characters).
+   * @param filename Name of the SD file (8.3 format, max 12 characters, ESP32 needs a leading '/').
    * @param pin SD card chip select pin (default: 4).
    * @return true if initialization successful, false otherwise.
    */
   bool begin(size_t size, const char *filename, int pin = 4);
 
+  /**
+   * @brief Initializes the SD card and opens the storage file with optional settings.
+   * @param size Size of the emulated storage in bytes.
+   * @param filename Name of the SD file (8.3 format, max 12 characters, ESP32 needs a leading '/').
+   * @param pin SD card chip select pin.
+   * @param config Cache and calibration settings.
+   * @return true if initialization successful, false otherwise.
+   */
+  bool begin(size_t size, const char *filename, int pin, const SDStorageConfig &config);
+
+#if SDSTORAGE_FS
+  /**
+   * @brief Opens the storage file on an already mounted Arduino filesystem.
+   * @details Uses the same file format as the SD path, so LittleFS on internal flash
+   *          holds the same image as a card. The filesystem is not restarted when a
+   *          transfer fails; poll() only reopens the file.
+   * @param size Size of the emulated storage in bytes.
+   * @param filename Path of the file (max 12 characters, LittleFS needs a leading '/').
+   * @param fs Mounted filesystem, for example LittleFS (must outlive the storage).
+   * @param config Cache and calibration settings.
+   * @return true if initialization successful, false otherwise.
+   */
+  bool begin(size_t size, const char *filename, fs::FS &fs, const SDStorageConfig &config = SDStorageConfig());
+#endif
+
+  /**
+   * @brief Probes the card on a scratch region behind the data area and adopts the result.
+   * @details Measures single-sector and multi-sector write latency, read latency and
+   *          flush cost, derives page size, write-back batch and flush threshold from
+   *          them and persists the tuning in the metadata block. The scratch region
+   *          lies behind the metadata and doubles as the migration journal, so
+   *          calibration is refused while a migration is pending.
+   * @return true if successful, false otherwise.
+   */
+  bool calibrate();
+
+  /**
+   * @brief Starts an asynchronous read.
+   * @details If the range is cached (resident pages, volatile regions or a shared image)
+   *          the read completes before returning and the callback runs immediately.
+   *          Otherwise it is queued and completed by poll(); queued reads touching the
+   *          same sectors are merged into one pass over the card.
+   * @param addr Starting address.
+   * @param buffer Destination buffer, must stay valid until completion.
+   * @param length Number of bytes to read.
+   * @param future Caller-owned request state, must stay alive until completion.
+   * @param callback Invoked on completion (optional).
+   * @param context Passed to callback.
+   * @return true if completed or queued, false if the address is invalid or future is already queued.
+   */
+  bool readArrayAsync(uint16_t addr, uint8_t *buffer, uint16_t length, SDStorageFuture &future,
+                      SDStorageReadCallback callback = nullptr, void *context = nullptr);
+
+  /**
+   * @brief Removes a queued asynchronous read without invoking its callback.
+   * @param future Read to cancel; its status becomes SDSTORAGE_ERR_IO if it was still queued.
+   */
+  void cancelRead(SDStorageFuture &future);
+
+  /**
+   * @brief Returns the schema version stored with the data.
+   * @return Version, 0 for files that were never migrated.
+   */
+  uint16_t getSchemaVersion() const;
+
+  /**
+   * @brief Brings the data to the newest schema version in one streaming pass.
+   * @details Steps with a version above getSchemaVersion() are chained: each reads the
+   *          image produced by the one before through its SDStorageMigrationSource. The
+   *          new content of the union of their ranges is built into a journal behind the
+   *          metadata area, committed with one header write and then copied over the
+   *          data area. A reset during the copy is completed at the next begin().
+   *          The duration is reported in getStats().migrationMs.
+   * @param steps Steps in ascending version order.
+   * @param count Number of steps.
+   * @return true if migrated or already current, false on error (the data is unchanged).
+   */
+  bool migrate(const SDStorageMigration *steps, uint8_t count);
+
+  /**
+   * @brief Opens a write batch for snapshot readers.
+   * @details Until commitBatch(), readSnapshot() returns the data as it was when the
+   *          batch was opened, while writes proceed normally. The old bytes of each
+   *          write are kept in the snapshotBytes log (read from the card first if not
+   *          cached). updateArray() opens an implicit batch around all of its slices.
+   * @return true if opened, false if snapshots are disabled or a batch is already open.
+   */
+  bool beginBatch();
+
+  /**
+   * @brief Closes the write batch; snapshot readers see the new data from now on.
+   */
+  void commitBatch();
+
+  /**
+   * @brief Reads a range as of the start of the open write batch.
+   * @details Without an open batch this is readArray(). Runs in the writer's task, for
+   *          example between updateArray() slices: it reads through the cache like
+   *          readArray() and may load or evict pages. From another core or task use
+   *          readSnapshotCached().
+   * @param addr Starting address.
+   * @param buffer Buffer to store data.
+   * @param length Number of bytes to read.
+   * @return Pointer to the buffer, or nullptr on error or, with status SDSTORAGE_IN_PROGRESS,
+   *         if the batch outgrew snapshotBytes (retry after commitBatch()).
+   */
+  uint8_t *readSnapshot(uint16_t addr, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Replaces a value only if it still holds the expected value.
+   * @tparam T 8, 16 or 32-bit integer type.
+   * @param addr Address of the value.
+   * @param expected Expected value; receives the current value if the compare fails.
+   * @param desired Value to store.
+   * @return true if swapped, false if the compare failed (status SDSTORAGE_OK) or on error.
+   */
+  template <class T>
+  bool compareAndSwap(uint16_t addr, T &expected, T desired) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    bool ret = _modify(addr, sizeof(T), MODIFY_CAS, (uint32_t)desired, (uint32_t)expected, old);
+    if (!ret && _status == SDSTORAGE_OK) expected = (T)old;
+    return ret;
+  }
+
+  /**
+   * @brief Adds to a value, wrapping around on overflow.
+   * @tparam T 8, 16 or 32-bit integer type.
+   * @param addr Address of the value.
+   * @param value Addend.
+   * @return Value before the addition, 0 on error (see getStatus()).
+   */
+  template <class T>
+  T fetchAdd(uint16_t addr, T value) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    return _modify(addr, sizeof(T), MODIFY_ADD, (uint32_t)value, 0, old) ? (T)old : 0;
+  }
+
+  /**
+   * @brief Bitwise ORs a mask into a value.
+   * @tparam T 8, 16 or 32-bit integer type.
+   * @param addr Address of the value.
+   * @param mask Bits to set.
+   * @return Value before the operation, 0 on error (see getStatus()).
+   */
+  template <class T>
+  T fetchOr(uint16_t addr, T mask) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    return _modify(addr, sizeof(T), MODIFY_OR, (uint32_t)mask, 0, old) ? (T)old : 0;
+  }
+
+  /**
+   * @brief Bitwise ANDs a mask into a value.
+   * @tparam T 8, 16 or 32-bit integer type.
+   * @param addr Address of the value.
+   * @param mask Bits to keep.
+   * @return Value before the operation, 0 on error (see getStatus()).
+   */
+  template <class T>
+  T fetchAnd(uint16_t addr, T mask) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    return _modify(addr, sizeof(T), MODIFY_AND, (uint32_t)mask, 0, old) ? (T)old : 0;
+  }
+
+  /**
+   * @brief Sets one bit of a value.
+   * @tparam T 8, 16 or 32-bit integer type the bit belongs to.
+   * @param addr Address of the value.
+   * @param bit Bit number (0 = least significant).
+   * @return true if successful, false on error.
+   */
+  template <class T>
+  bool setBit(uint16_t addr, uint8_t bit) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    return _modify(addr, sizeof(T), MODIFY_OR, 1UL << bit, 0, old);
+  }
+
+  /**
+   * @brief Clears one bit of a value.
+   * @tparam T 8, 16 or 32-bit integer type the bit belongs to.
+   * @param addr Address of the value.
+   * @param bit Bit number (0 = least significant).
+   * @return true if successful, false on error.
+   */
+  template <class T>
+  bool clearBit(uint16_t addr, uint8_t bit) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "8, 16 or 32-bit values only");
+    uint32_t old;
+    return _modify(addr, sizeof(T), MODIFY_AND, ~(1UL << bit), 0, old);
+  }
+
+  /**
+   * @brief Reads a range only if it is held in RAM, without touching the card or the cache state.
+   * @details With SDSTORAGE_SEQLOCK (default on ESP32) this may be called from another
+   *          core or task than the one doing all other calls: each cache page carries a
+   *          sequence counter, readers copy without locking and retry only when they
+   *          overlap a concurrent change of that page, and the writer never waits.
+   *          The reader must stop before begin(), close() or format() reallocates the cache.
+   * @param addr Starting address.
+   * @param buffer Buffer to store data.
+   * @param length Number of bytes to read.
+   * @return true if the whole range was copied, false if part of it is not cached
+   *         (read it through the writer's context instead).
+   */
+  bool readCached(uint16_t addr, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Reads a range as of the start of the open write batch, only if it is held in RAM.
+   * @details readCached() with the snapshot of readSnapshot(): a range written by a
+   *          batch reads as it was before the batch until commitBatch(), as a whole,
+   *          even across pages. With SDSTORAGE_SEQLOCK this may run on another core
+   *          or task; a batch that opens or commits during the copy makes it retry,
+   *          the writer never waits.
+   * @param addr Starting address.
+   * @param buffer Buffer to store data.
+   * @param length Number of bytes to read.
+   * @return true if the whole range was copied, false if part of it is not cached or
+   *         the open batch outgrew snapshotBytes (read it through the writer's context instead).
+   */
+  bool readSnapshotCached(uint16_t addr, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Defers work to the next poll().
+   * @details Used by the awaitable API to resume coroutines from the poll loop. A
+   *          waiter must not be deferred twice before it has run.
+   * @param waiter Caller-owned waiter, must stay alive until its callback has run.
+   */
+  void defer(SDStorageWaiter &waiter);
+
+  /**
+   * @brief Subscribes to changes of an address range.
+   * @details Every write that touches the range increments watch.version once it is
+   *          committed: right away, or at commitBatch() inside a write batch. Compare it
+   *          with the last version seen to skip re-reading unchanged settings. The
+   *          callback runs from poll(), once for any number of changes since the last
+   *          call, with the smallest part of the range covering all of them; it may
+   *          call unwatch() on its own watch.
+   * @param watch Caller-owned subscription, must stay alive until unwatch().
+   * @param addr First address to watch.
+   * @param length Number of bytes to watch.
+   * @param callback Invoked after changes (optional).
+   * @param context Passed to callback.
+   * @return true if subscribed, false if the range is invalid or the watch is already subscribed.
+   */
+  bool watch(SDStorageWatch &watch, uint16_t addr, uint16_t length,
+             SDStorageWatchCallback callback = nullptr, void *context = nullptr);
+
+  /**
+   * @brief Ends a subscription; its callback is not invoked anymore.
+   * @param watch Subscription passed to watch().
+   */
+  void unwatch(SDStorageWatch &watch);
+
+#if SDSTORAGE_COROUTINES
+  /**
+   * @brief Awaitable readArray(), see readArrayAsync().
+   * @details Does not suspend if the data is cached, otherwise resumes from poll().
+   * @param addr Starting address.
+   * @param buffer Destination buffer.
+   * @param length Number of bytes to read.
+   * @return Awaiter yielding the SDStorageStatus of the read.
+   */
+  SDStorageAwait readAwait(uint16_t addr, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Awaitable writeArray().
+   * @details Suspends while a time-sliced format() is in progress and retries from poll().
+   * @param addr Starting address.
+   * @param buffer Data to write.
+   * @param length Number of bytes to write.
+   * @return Awaiter yielding the SDStorageStatus of the write.
+   */
+  SDStorageAwait writeAwait(uint16_t addr, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Awaitable updateArray().
+   * @details With a time budget set, each slice runs from a separate poll() call.
+   * @param addr Starting address.
+   * @param buffer Data to write.
+   * @param length Number of bytes to update.
+   * @return Awaiter yielding the SDStorageStatus of the update.
+   */
+  SDStorageAwait updateAwait(uint16_t addr, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Awaitable flush(), always suspends and writes back from the next poll().
+   * @return Awaiter yielding SDSTORAGE_OK, or SDSTORAGE_ERR_OFFLINE if the card failed.
+   */
+  SDStorageAwait flushAwait();
+#endif
+
+  /**
+   * @brief Services background work: recovery after a card failure, queued asynchronous
+   *        reads, deferred waiters, watch callbacks and expired write-backs.
+   * @details Call from loop(). While the storage is offline, recovery is attempted with
+   *          exponential backoff from 100 ms to 30 s: the card is restarted with SD.end()
+   *          and SD.begin() once for all instances on it (fs::FS instances instead call
+   *          SDStorageConfig::remount if set and never touch the SD library), the file is
+   *          reopened, its size header checked and the pending pages written back. Cached
+   *          data stays readable during the outage. Pages whose region maxAge expired are
+   *          written back here; flushes on reaching the flush threshold are not, for
+   *          instances attached to an SDScheduler they run as a burst of the scheduler.
+   */
+  void poll();
+
+  /**
+   * @brief Returns whether the card is usable.
+   * @return false between a card failure and its recovery by poll().
+   */
+  bool isOnline() const;
+
+  /**
+   * @brief Sets the callback invoked between chunks of format(), updateArray() and verifyArray().
+   * @details Use it to feed the watchdog or service the main loop during long operations.
+   * @param callback Callback, or nullptr to disable.
+   * @param context Pointer passed back to the callback.
+   */
+  void setProgress(SDStorageProgress callback, void *context = nullptr);
+
+  /**
+   * @brief Bounds the time a single format(), updateArray() or verifyArray() call may take.
+   * @details When the budget is used up the call returns false with status
+   *          SDSTORAGE_IN_PROGRESS; calling it again with the same arguments resumes
+   *          it. While a format is pending every other call that touches the file (flush(),
+   *          setPartitions(), migrate(), calibrate() and blob commits included) is
+   *          rejected the same way, and queued asynchronous reads wait.
+   *          The stall per call is bounded by the budget plus one chunk.
+   * @param us Budget in microseconds (0 = unlimited).
+   */
+  void setTimeBudget(uint32_t us);
+
+  /**
+   * @brief Divides the data area into named partitions, laid out in the given order.
+   * @details The table is persisted in the metadata area and survives format(). Each
+   *          partition is accessed through an SDPartition with its own address space,
+   *          but shares this instance's file handle, cache and write-back pass. Changing
+   *          the table does not move existing data.
+   * @param partitions Partition definitions (region.start is ignored).
+   * @param count Number of partitions, at most SDSTORAGE_MAX_PARTITIONS.
+   * @return true if successful, false if the partitions do not fit or are invalid.
+   */
+  bool setPartitions(const SDStoragePartition *partitions, uint8_t count);
+
+  /**
+   * @brief Returns the I/O counters.
+   * @return Counters since begin() or resetStats().
+   */
+  const SDStorageStats &getStats() const;
+
+  /**
+   * @brief Resets the I/O counters (the wear table is kept).
+   */
+  void resetStats();
+
+  /**
+   * @brief Takes the oldest record from the event ring.
+   * @details Transfer errors, outages and recoveries are recorded as fixed-size binary
+   *          records without formatting, so they can be drained and printed outside
+   *          the I/O path. The ring keeps the newest SDSTORAGE_EVENTS records and
+   *          counts overwritten ones in getStats().eventsLost.
+   * @param event Receives the record.
+   * @return true if a record was taken, false if the ring is empty or compiled out.
+   */
+  bool readEvent(SDStorageEvent &event);
+
+  /**
+   * @brief Returns physical bytes programmed per logical byte written.
+   * @details (sectorWrites + flushes) * 512 / logicalBytes, 0 if nothing was written.
+   * @return Write amplification factor.
+   */
+  float getWriteAmplification() const;
+
+  /**
+   * @brief Estimates the card busy time of the counted I/O from the calibrated latencies.
+   * @details sectorWrites * multiWriteUs + sectors read * readUs + flushes * flushUs.
+   *          Depends only on the counters and the tuning, not on the clock, so it is
+   *          stable across runs. 0 until calibrate() has measured the card.
+   * @return Estimated busy time in microseconds.
+   */
+  uint32_t getModelTime() const;
+
+  /**
+   * @brief Prints the counters as one JSON object per line for benchmark tooling.
+   * @details {"scenario":"<name>","logicalBytes":..,"issuedBytes":..,"sectorWrites":..,
+   *          "readBytes":..,"verifyBytes":..,"flushes":..,"seeks":..,"retries":..,"modelUs":..,
+   *          "ms":..,"latency":[..]}, latency only with SDSTORAGE_LATENCY. Compared against a
+   *          baseline by tools/sdbench.py; periodic lines are charted by tools/sdsoak.py.
+   * @param out Output, for example Serial.
+   * @param scenario Name of the measured scenario (no quotes or backslashes).
+   */
+  void printStats(Print &out, const char *scenario) const;
+
+  /**
+   * @brief Computes the RAM a configuration needs, usable in static_assert.
+   * @details The stack figure is the largest sum of library buffers live at once, on
+   *          the deepest of these chains, each ending in the _verifyDirect() read-back
+   *          of a page evicted on the way:
+   *          - updateArray() -> _compare() -> page load: two chunks.
+   *          - migrate() -> _replayJournal() -> re-pinning: two chunks, two journal headers.
+   *          - calibrate() -> cache reallocation: the probe sector.
+   *          Shallower chains, such as SDPartition::format() -> writeArray() with one
+   *          chunk, are covered by these. Stack frames, PersistentArray windows and
+   *          buffers of migration build functions and read callbacks are not included.
+   *          Wear tracking and the image only apply to writable and read-only mounts
+   *          respectively.
+   * @param size Storage size in bytes.
+   * @param cachePages SDStorageConfig::cachePages.
+   * @param pageSize Cache page size (512 unless calibrate() picks a larger one).
+   * @param snapshotBytes SDStorageConfig::snapshotBytes.
+   * @param volatileBytes Total length of the SDSTORAGE_VOLATILE regions.
+   * @param trackWear SDStorageConfig::trackWear.
+   * @param profileLine SDStorageConfig::profileLine.
+   * @param cacheImage SDStorageConfig::cacheImage (shared by all readers of the file).
+   * @param calibrate SDStorageConfig::calibrate.
+   * @return Static, stack and heap bytes.
+   */
+  static constexpr SDStorageFootprint footprint(uint32_t size, uint8_t cachePages = 0, uint16_t pageSize = 512,
+                                                uint16_t snapshotBytes = 0, uint16_t volatileBytes = 0,
+                                                bool trackWear = false, uint16_t profileLine = 0,
+                                                bool cacheImage = false, bool calibrate = false) {
+    // 4-byte size header and 512-byte sectors, see SDStorage.cpp.
+    return SDStorageFootprint{(uint32_t)(sizeof(SDStorage) + sizeof(_shared)),
+                              VERIFY_CHUNK + _max(2 * SDSTORAGE_CHUNK_SIZE + 2 * JOURNAL_HEADER, calibrate ? PROBE_SECTOR : 0),
+                              (uint32_t)(cachePages * (sizeof(Page) + pageSize) + snapshotBytes + volatileBytes +
+                                         (trackWear ? (4 + size + 511) / 512 * sizeof(uint16_t) : 0) +
+                                         (profileLine ? (size + profileLine - 1) / profileLine * 2 * sizeof(uint16_t) : 0) +
+                                         (cacheImage ? size : 0))};
+  }
+
+  /**
+   * @brief Returns the RAM used by this instance as configured at begin().
+   * @details Counts what was actually allocated, so failed or skipped allocations
+   *          and the page size chosen by calibrate() are taken into account.
+   * @return Static, stack and heap bytes.
+   */
+  SDStorageFootprint getFootprint() const;
+
+  /**
+   * @brief Returns the number of writes to a 512-byte file sector.
+   * @param sector Sector index (file offset / 512, header included).
+   * @return Write count, 0 if wear tracking is disabled.
+   */
+  uint32_t getSectorWrites(uint16_t sector) const;
+
+  /**
+   * @brief Prints the wear heatmap as "sector,writes" lines.
+   * @param out Output, for example Serial.
+   */
+  void printWear(Print &out) const;
+
+  /**
+   * @brief Prints the access profile for the host-side analysis tool.
+   * @details First line "# line=<bytes> size=<bytes> page=<bytes>", then "line,reads,writes"
+   *          for every line with accesses. Counters saturate at 65535.
+   * @param out Output, for example Serial.
+   */
+  void printProfile(Print &out) const;
+
+  /**
+   * @brief Clears the access profile counters.
+   */
+  void resetProfile();
+
+  /**
+   * @brief Returns the result of the last read, write or format call.
+   * @return Status code.
+   */
+  SDStorageStatus getStatus() const;
+
+  /**
+   * @brief Returns the active I/O tuning.
+   * @return Tuning parameters.
+   */
+  const SDStorageTuning &getTuning() const;
+
   /**
    * @brief Reads a single byte from the specified address.
    * @param addr Address (0 to size-1).
@@ -161,3 +1747,73 @@ class SDStorage : public StorageBase {
    */
   bool verifyArray(uint16_t addr, const uint8_t *buffer, uint16_t length);
 };
+
+#if SDSTORAGE_COROUTINES
+/**
+ * @brief Awaiter returned by SDStorage::readAwait(), writeAwait(), updateAwait() and flushAwait().
+ * @details Lives in the awaiting coroutine's frame and allocates nothing; the
+ *          coroutine is resumed from SDStorage::poll(). Await it immediately and
+ *          only once.
+ */
+class SDStorageAwait {
+ public:
+  /**
+   * @brief Awaited operation.
+   */
+  enum Op : uint8_t { READ, WRITE, UPDATE, FLUSH };
+
+  /**
+   * @brief Constructs an awaiter, use the SDStorage factory methods instead.
+   * @param storage Storage to operate on.
+   * @param op Operation.
+   * @param addr Starting address.
+   * @param buffer Data buffer.
+   * @param length Number of bytes.
+   */
+  SDStorageAwait(SDStorage &storage, Op op, uint16_t addr, uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Starts the operation.
+   * @return true if it completed without blocking, false to suspend.
+   */
+  bool await_ready();
+
+  /**
+   * @brief Parks the coroutine until poll() completes the operation.
+   * @param handle Awaiting coroutine.
+   */
+  void await_suspend(std::coroutine_handle<> handle);
+
+  /**
+   * @brief Returns the result.
+   * @return Status of the operation.
+   */
+  SDStorageStatus await_resume() const;
+
+ private:
+  SDStorage &_storage;              ///< Storage operated on.
+  Op _op;                           ///< Awaited operation.
+  SDStorageFuture _future;          ///< Read request, and the result of every operation.
+  SDStorageWaiter _waiter;          ///< Retry or flush hook run from poll().
+  std::coroutine_handle<> _handle;  ///< Suspended coroutine, null until await_suspend().
+
+  /**
+   * @brief Issues a write, update or flush.
+   * @return true if finished, false if it must be retried from poll().
+   */
+  bool _issue();
+
+  /**
+   * @brief Read completion callback, resumes the coroutine.
+   * @param future Completed read.
+   * @param context This awaiter.
+   */
+  static void _onRead(SDStorageFuture *future, void *context);
+
+  /**
+   * @brief Deferred work callback, retries the operation and resumes when finished.
+   * @param waiter Deferred waiter of this awaiter.
+   */
+  static void _onPoll(SDStorageWaiter *waiter);
+};
+#endif
@@ -0,0 +1,100 @@
+#include "SDStorageImage.h"
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_HEADER_SIZE 4
+
+SDStorageImage::~SDStorageImage() {
+  close();
+}
+
+bool SDStorageImage::open(const char *path, bool writable) {
+  close();
+  _fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+  if (_fd < 0) return false;
+  struct stat st;
+  if (fstat(_fd, &st) != 0 || st.st_size < FILE_HEADER_SIZE) {
+    close();
+    return false;
+  }
+  _mapped = st.st_size;
+  void *map = mmap(nullptr, _mapped, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    close();
+    return false;
+  }
+  _map = (uint8_t *)map;
+  _writable = writable;
+  uint8_t *h = _map;
+  _size = h[0] | (uint32_t)h[1] << 8 | (uint32_t)h[2] << 16 | (uint32_t)h[3] << 24;
+  if ((uint64_t)_size + FILE_HEADER_SIZE > _mapped) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool SDStorageImage::create(const char *path, uint32_t size, uint8_t v) {
+  close();
+  int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  uint8_t header[FILE_HEADER_SIZE] = {(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24)};
+  bool ok = write(fd, header, sizeof(header)) == (ssize_t)sizeof(header) && ftruncate(fd, FILE_HEADER_SIZE + (off_t)size) == 0;
+  ::close(fd);
+  if (!ok || !open(path, true)) return false;
+  memset(_map + FILE_HEADER_SIZE, v, _size);
+  return true;
+}
+
+void SDStorageImage::close() {
+  if (_map) munmap(_map, _mapped);
+  if (_fd >= 0) ::close(_fd);
+  _fd = -1;
+  _map = nullptr;
+  _mapped = 0;
+  _size = 0;
+  _writable = false;
+}
+
+const uint8_t *SDStorageImage::span(uint16_t addr, uint32_t length) const {
+  if (!_map || addr > _size || length > _size - addr) return nullptr;
+  return _map + FILE_HEADER_SIZE + addr;
+}
+
+uint8_t *SDStorageImage::writableSpan(uint16_t addr, uint32_t length) {
+  if (!_writable) return nullptr;
+  return const_cast<uint8_t *>(span(addr, length));
+}
+
+const uint8_t *SDStorageImage::fileSpan(size_t offset, size_t length) const {
+  if (!_map || offset > _mapped || length > _mapped - offset) return nullptr;
+  return _map + offset;
+}
+
+bool SDStorageImage::readArray(uint16_t addr, uint8_t *buffer, uint16_t length) const {
+  const uint8_t *p = span(addr, length);
+  if (!p) return false;
+  memcpy(buffer, p, length);
+  return true;
+}
+
+bool SDStorageImage::writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length) {
+  uint8_t *p = writableSpan(addr, length);
+  if (!p) return false;
+  memcpy(p, buffer, length);
+  return true;
+}
+
+bool SDStorageImage::flush(bool wait) {
+  if (!_map) return false;
+  if (!_writable) return true;
+  return msync(_map, _mapped, wait ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+#endif
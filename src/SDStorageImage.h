@@ -0,0 +1,149 @@
+/**
+ * @file SDStorageImage.h
+ * @brief Header file for the SDStorageImage class, memory-mapped access to SDStorage files on host systems.
+ * @author Ferenc Mayer
+ * @date 2025-06-02
+ */
+
+#pragma once
+/**
+ * @brief Prevents multiple inclusions of the header file.
+ */
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+/**
+ * @brief Only available on POSIX hosts; Arduino builds compile this file out.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+/**
+ * @brief Includes fixed-width integer types.
+ */
+
+/**
+ * @brief An SDStorage image file copied from a card, mapped into memory.
+ * @details Uses the on-card layout: a 4-byte little-endian size header, the data
+ *          area, then the metadata block, which is kept as is. The whole file is
+ *          mapped. Addresses are those of SDStorage, relative to the data area, so
+ *          address 0 is file offset 4; fileSpan() reaches the header and the metadata
+ *          block by raw file offset. Reads and writes are memcpy on the mapping and
+ *          span() hands out pointers into it, so host tools and tests can scan many
+ *          images without copying them. Writes reach the file through the page cache;
+ *          flush() makes them durable with msync().
+ */
+class SDStorageImage {
+ private:
+  int _fd = -1;              ///< File descriptor of the image.
+  uint8_t *_map = nullptr;   ///< Mapping of the whole file.
+  size_t _mapped = 0;        ///< Length of the mapping.
+  uint32_t _size = 0;        ///< Size of the data area from the header.
+  bool _writable = false;    ///< Mapped for writing.
+
+ public:
+  /**
+   * @brief Constructs a closed image.
+   */
+  SDStorageImage() = default;
+
+  /**
+   * @brief Destructor, unmaps and closes the file without msync().
+   */
+  ~SDStorageImage();
+
+  SDStorageImage(const SDStorageImage &) = delete;
+  SDStorageImage &operator=(const SDStorageImage &) = delete;
+
+  /**
+   * @brief Maps an existing image.
+   * @param path Path of the image file.
+   * @param writable true to map it for writing (shared with the file).
+   * @return true if successful, false if the file cannot be mapped or is shorter than its header claims.
+   */
+  bool open(const char *path, bool writable = false);
+
+  /**
+   * @brief Creates an image like SDStorage::format() and maps it for writing.
+   * @details The metadata block is left out; SDStorage falls back to the default
+   *          tuning and recreates it on the card.
+   * @param path Path of the image file, replaced if it exists.
+   * @param size Size of the data area in bytes.
+   * @param v Value every data byte is set to.
+   * @return true if successful, false otherwise.
+   */
+  bool create(const char *path, uint32_t size, uint8_t v = 0);
+
+  /**
+   * @brief Unmaps and closes the image without msync().
+   */
+  void close();
+
+  /**
+   * @brief Tells whether an image is mapped.
+   * @return true if open.
+   */
+  bool isOpen() const { return _map != nullptr; }
+
+  /**
+   * @brief Returns the size of the data area.
+   * @return Size in bytes, 0 if closed.
+   */
+  uint32_t getSize() const { return _size; }
+
+  /**
+   * @brief Returns the size of the whole file, header and metadata block included.
+   * @return Size in bytes, 0 if closed.
+   */
+  size_t getFileSize() const { return _mapped; }
+
+  /**
+   * @brief Returns a pointer into the mapping, without copying.
+   * @param addr Starting address in the data area (file offset addr + 4).
+   * @param length Number of bytes the caller will access.
+   * @return Pointer to addr, nullptr if the range is outside the data area.
+   */
+  const uint8_t *span(uint16_t addr, uint32_t length) const;
+
+  /**
+   * @brief Returns a writable pointer into the mapping, without copying.
+   * @param addr Starting address.
+   * @param length Number of bytes the caller will access.
+   * @return Pointer to addr, nullptr if the range is invalid or the image is read-only.
+   */
+  uint8_t *writableSpan(uint16_t addr, uint32_t length);
+
+  /**
+   * @brief Returns a pointer into the mapping by raw file offset, without copying.
+   * @param offset Offset from the start of the file.
+   * @param length Number of bytes the caller will access.
+   * @return Pointer to offset, nullptr if the range is outside the file.
+   */
+  const uint8_t *fileSpan(size_t offset, size_t length) const;
+
+  /**
+   * @brief Copies bytes out of the image.
+   * @param addr Starting address.
+   * @param buffer Buffer to store data.
+   * @param length Number of bytes to read.
+   * @return true if successful, false if the range is invalid.
+   */
+  bool readArray(uint16_t addr, uint8_t *buffer, uint16_t length) const;
+
+  /**
+   * @brief Copies bytes into the image.
+   * @param addr Starting address.
+   * @param buffer Data to write.
+   * @param length Number of bytes to write.
+   * @return true if successful, false if the range is invalid or the image is read-only.
+   */
+  bool writeArray(uint16_t addr, const uint8_t *buffer, uint16_t length);
+
+  /**
+   * @brief Writes the modified pages of the mapping back to the file.
+   * @param wait true to wait until they are stored (MS_SYNC), false to only schedule it.
+   * @return true if successful, false otherwise.
+   */
+  bool flush(bool wait = true);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Keeps benchmark baselines of SDStorage counters and flags regressions.
+
+Reads the JSON lines printed by printStats() (serial log lines outside them are
+ignored). The counters are deterministic for a given scenario and backend, so
+they are compared instead of wall time; modelUs only depends on the counters
+and the calibrated latencies. The clock ("ms") and the latency histogram are
+not compared.
+
+Usage: sdbench.py record run.log baseline.json
+       sdbench.py compare baseline.json run.log [--tolerance 0.05] [--ignore seeks]
+
+compare exits with status 1 if any counter of a scenario exceeds its baseline
+by more than the tolerance, so it can gate a CI job.
+"""
+
+import argparse
+import json
+import sys
+
+WALL_CLOCK = ("ms", "latency")
+
+
+def load(path):
+    """Returns {scenario: counters}; a later run of the same scenario wins."""
+    results = {}
+    with open(path) as f:
+        for text in f:
+            text = text.strip()
+            if not text.startswith('{"scenario":'):
+                continue
+            try:
+                record = json.loads(text)
+            except ValueError:
+                continue
+            results[record.pop("scenario")] = record
+    if not results:
+        sys.exit("no printStats() results found in %s" % path)
+    return results
+
+
+def record(args):
+    results = load(args.log)
+    with open(args.baseline, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print("%d scenarios written to %s" % (len(results), args.baseline))
+
+
+def compare(args):
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    results = load(args.log)
+    failed = 0
+    for scenario in sorted(set(baseline) | set(results)):
+        if scenario not in results:
+            print("%-24s missing from run" % scenario)
+            continue
+        if scenario not in baseline:
+            print("%-24s new (no baseline)" % scenario)
+            continue
+        worse = []
+        for name, base in sorted(baseline[scenario].items()):
+            if name in args.ignore or name in WALL_CLOCK:
+                continue
+            value = results[scenario].get(name, 0)
+            # A zero baseline tolerates nothing; absolute slack avoids flagging 1 -> 2 as noise.
+            if value > base * (1 + args.tolerance) + args.slack:
+                worse.append("%s %d -> %d" % (name, base, value))
+        if worse:
+            failed += 1
+            print("%-24s REGRESSED: %s" % (scenario, ", ".join(worse)))
+        else:
+            print("%-24s ok" % scenario)
+    if failed:
+        print("%d of %d scenarios regressed" % (failed, len(baseline)))
+        sys.exit(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+    p = commands.add_parser("record", help="store the results of a run as baseline")
+    p.add_argument("log")
+    p.add_argument("baseline")
+    p.set_defaults(run=record)
+    p = commands.add_parser("compare", help="compare a run against a baseline")
+    p.add_argument("baseline")
+    p.add_argument("log")
+    p.add_argument("--tolerance", type=float, default=0.05, help="allowed relative increase (default 0.05)")
+    p.add_argument("--slack", type=int, default=0, help="allowed absolute increase (default 0)")
+    p.add_argument("--ignore", action="append", default=[], help="counter to skip, may be repeated")
+    p.set_defaults(run=compare)
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()
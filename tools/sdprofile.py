@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Analyses an SDStorage access profile captured with printProfile().
+
+Reads the dump (serial log lines outside the dump are ignored), aggregates the
+line counters to cache pages and recommends a page count and a pin list. The
+page size is not configurable: it is 512 bytes unless calibrate() picked a
+larger one, so pass getTuning().pageSize with --page in that case. The profile
+holds access counts, not their order, so hit rates assume the most accessed
+pages stay resident.
+
+Usage: sdprofile.py dump.txt [--target 0.9] [--ram 8192] [--page 512]
+"""
+
+import argparse
+import re
+import sys
+
+FILE_HEADER_SIZE = 4
+
+
+def load(path):
+    line_size = size = None
+    lines = {}
+    with open(path) as f:
+        for text in f:
+            text = text.strip()
+            m = re.match(r"# line=(\d+) size=(\d+)", text)
+            if m:
+                line_size, size = int(m.group(1)), int(m.group(2))
+                lines = {}
+                continue
+            m = re.match(r"^(\d+),(\d+),(\d+)$", text)
+            if m and line_size:
+                lines[int(m.group(1))] = (int(m.group(2)), int(m.group(3)))
+    if not line_size:
+        sys.exit("no profile header found in %s" % path)
+    return line_size, size, lines
+
+
+def pages(line_size, lines, page_size):
+    """Sums line counters per cache page; pages are aligned to file offsets."""
+    result = {}
+    for line, (reads, writes) in lines.items():
+        page = (line * line_size + FILE_HEADER_SIZE) // page_size
+        r, w = result.get(page, (0, 0))
+        result[page] = (r + reads, w + writes)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump")
+    parser.add_argument("--target", type=float, default=0.9, help="hit rate to reach (default 0.9)")
+    parser.add_argument("--ram", type=int, default=8192, help="cache RAM budget in bytes (default 8192)")
+    parser.add_argument("--page", type=int, default=512, help="page size in use, getTuning().pageSize (default 512)")
+    args = parser.parse_args()
+
+    line_size, size, lines = load(args.dump)
+    total = sum(r + w for r, w in lines.values())
+    if not total:
+        sys.exit("profile is empty")
+    print("size=%d line=%d accesses=%d" % (size, line_size, total))
+
+    if args.page < 512 or args.page & (args.page - 1):
+        sys.exit("page size must be a power of two of at least 512")
+    counts = sorted(pages(line_size, lines, args.page).items(), key=lambda p: -(p[1][0] + p[1][1]))
+    hits = 0
+    for n, (_, (r, w)) in enumerate(counts, 1):
+        hits += r + w
+        if hits >= args.target * total:
+            break
+    # Keep one page evictable for the remaining traffic.
+    ram = (n + 1) * args.page
+    print("page=%5d pages=%3d ram=%6d hit=%.3f" % (args.page, n, ram, hits / total))
+    if ram > args.ram:
+        print("the target hit rate needs %d bytes, over the budget of %d" % (ram, args.ram))
+        return
+    pins = [page * args.page - FILE_HEADER_SIZE if page else 0 for page, _ in counts[:n]]
+    print()
+    print("recommended: %d cache pages (%d bytes)" % (n + 1, ram))
+    print("static const uint16_t pins[] = {%s};" % ", ".join(str(p) for p in sorted(pins)))
+    print("config.cachePages = %d;" % (n + 1))
+    print("config.pins = pins;")
+    print("config.pinCount = %d;" % len(pins))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Charts a long SDStorage soak run from periodic printStats() lines.
+
+The soak driver prints printStats(out, "soak") every interval without calling
+resetStats(), so each line holds running totals. Consecutive lines are
+differenced into intervals showing operations per second, the p50/p99/p99.9
+transfer latency (upper bound of the histogram bucket) and the write
+amplification. A trend bar per interval makes gradual degradation visible;
+the first and last quarter of the run are compared at the end.
+
+Usage: sdsoak.py run.log [--scenario soak] [--width 40] [--degrade 0.2]
+
+Exits with status 1 if throughput, p99 latency or write amplification got
+worse by more than --degrade between the first and the last quarter.
+"""
+
+import argparse
+import json
+import sys
+
+SECTOR_SIZE = 512
+
+
+def load(path, scenario):
+    samples = []
+    with open(path) as f:
+        for text in f:
+            text = text.strip()
+            if not text.startswith('{"scenario":'):
+                continue
+            try:
+                record = json.loads(text)
+            except ValueError:
+                continue
+            if record.get("scenario") == scenario:
+                samples.append(record)
+    if len(samples) < 2:
+        sys.exit("need at least two '%s' lines with running totals in %s" % (scenario, path))
+    if "latency" not in samples[0]:
+        sys.exit("no latency histogram, build with SDSTORAGE_LATENCY=1")
+    return samples
+
+
+def percentile(histogram, fraction):
+    """Upper bound in microseconds of the bucket holding the given fraction of operations."""
+    total = sum(histogram)
+    if not total:
+        return 0
+    seen = 0
+    for bucket, count in enumerate(histogram):
+        seen += count
+        if seen >= fraction * total:
+            return 2 << bucket
+    return 2 << (len(histogram) - 1)
+
+
+def intervals(samples):
+    """Differences consecutive running totals; a reboot (counters going back) starts over."""
+    result = []
+    for prev, cur in zip(samples, samples[1:]):
+        if cur["ms"] <= prev["ms"] or cur["logicalBytes"] < prev["logicalBytes"]:
+            continue
+        histogram = [c - p for c, p in zip(cur["latency"], prev["latency"])]
+        if min(histogram) < 0:
+            continue
+        seconds = (cur["ms"] - prev["ms"]) / 1000.0
+        logical = cur["logicalBytes"] - prev["logicalBytes"]
+        physical = (cur["sectorWrites"] - prev["sectorWrites"] + cur["flushes"] - prev["flushes"]) * SECTOR_SIZE
+        result.append({
+            "ms": cur["ms"],
+            "ops": sum(histogram) / seconds,
+            "p50": percentile(histogram, 0.5),
+            "p99": percentile(histogram, 0.99),
+            "p999": percentile(histogram, 0.999),
+            "wa": physical / logical if logical else 0.0,
+        })
+    if not result:
+        sys.exit("no usable intervals")
+    return result
+
+
+def quarter(rows, key, last):
+    n = max(1, len(rows) // 4)
+    part = rows[-n:] if last else rows[:n]
+    return sum(r[key] for r in part) / len(part)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log")
+    parser.add_argument("--scenario", default="soak", help="scenario name of the periodic lines (default soak)")
+    parser.add_argument("--width", type=int, default=40, help="width of the throughput bar (default 40)")
+    parser.add_argument("--degrade", type=float, default=0.2, help="allowed relative degradation (default 0.2)")
+    args = parser.parse_args()
+
+    rows = intervals(load(args.log, args.scenario))
+    peak = max(r["ops"] for r in rows) or 1
+    print("%10s %10s %8s %8s %8s %6s" % ("ms", "ops/s", "p50 us", "p99 us", "p99.9 us", "WA"))
+    for r in rows:
+        bar = "#" * int(round(args.width * r["ops"] / peak))
+        print("%10d %10.0f %8d %8d %8d %6.2f %s" % (r["ms"], r["ops"], r["p50"], r["p99"], r["p999"], r["wa"], bar))
+
+    worse = []
+    first, last = quarter(rows, "ops", False), quarter(rows, "ops", True)
+    if last < first * (1 - args.degrade):
+        worse.append("throughput %.0f -> %.0f ops/s" % (first, last))
+    for key, label in (("p99", "p99 latency"), ("wa", "write amplification")):
+        first, last = quarter(rows, key, False), quarter(rows, key, True)
+        if last > first * (1 + args.degrade):
+            worse.append("%s %.2f -> %.2f" % (label, first, last))
+    print()
+    if worse:
+        print("DEGRADED: " + ", ".join(worse))
+        sys.exit(1)
+    print("stable over %d intervals" % len(rows))
+
+
+if __name__ == "__main__":
+    main()